@@ -0,0 +1,105 @@
+//
+// Created by symek on 8/2/25.
+//
+// Microbenchmarks of the single stages exrprofile times, all in memory on one synthetic frame:
+// generating it, encoding it per codec, and decoding it back whole and one region at a time.
+#include <CLI/CLI.hpp>
+#include "libexrprofile.h"
+
+namespace {
+
+    void print_bench(const std::string &name, const exrprofile::Samples &samples, const uint64_t bytes) {
+        const auto stats = exrprofile::StatsSummary<long>::compute(samples, true);
+        const double median = (double) exrprofile::deref(stats.median);
+        fmt::print("{:>32}: median {:>9.3f} ms | p99 {:>9.3f} ms | {:>9.1f} MB/s\n", name,
+                   exrprofile::ns_to_ms(median), exrprofile::ns_to_ms(stats.p99),
+                   (double) bytes / (1024 * 1024) / std::max(exrprofile::ns_to_seconds(median), 1e-9));
+    }
+
+}
+
+int main(int argc, char **argv) {
+    CLI::App app{"EXR Profiler stage benchmarks"};
+
+    int scale = 1;
+    int threads = 1;
+    int region_rows = 64;
+    auto content = exrprofile::Content::noisy;
+    uint64_t seed = 0;
+    auto codec_names = std::vector<std::string>{};
+    auto harness = exrprofile::Harness{1, 5};
+
+    app.add_option("-s,--scale", scale, "Multiply of 1Kx1K frame size (default 1)");
+    app.add_option("-t,--threads", threads, "Threads per encode / decode (default 1)");
+    app.add_option("--region-rows", region_rows, "Rows of the region decode, rounded up to whole chunks (default 64)");
+    app.add_option("--content", content, "Frame content: flat, gradient, noisy (default), texture, alpha or depth")
+            ->transform(CLI::CheckedTransformer(std::map<std::string, exrprofile::Content>{
+                    {"flat",     exrprofile::Content::flat},
+                    {"gradient", exrprofile::Content::gradient},
+                    {"noisy",    exrprofile::Content::noisy},
+                    {"texture",  exrprofile::Content::texture},
+                    {"alpha",    exrprofile::Content::alpha},
+                    {"depth",    exrprofile::Content::depth}}, CLI::ignore_case));
+    app.add_option("--seed", seed, "Seed of the frame (default 0)");
+    app.add_option("--codecs", codec_names, "Only these codecs, e.g. zip,dwaa (default all)")->delimiter(',');
+    app.add_option("--warmup", harness.warmup, "Unmeasured runs of every benchmark (default 1)");
+    app.add_option("-n,--repeat", harness.repetitions, "Measured runs of every benchmark (default 5)");
+
+    try {
+        app.parse(argc, argv);
+    } catch (const CLI::ParseError &e) {
+        return app.exit(e);
+    }
+
+    const int width = std::clamp(scale, 1, 32) * 1024;
+    const int height = width;
+    const int hardware = (int) std::max(std::thread::hardware_concurrency(), 1u);
+
+    // Synthetic generation
+    exrprofile::ThreadPool generator_pool(hardware);
+    auto pixels = std::vector<Imf::Rgba>{};
+    const auto generate = exrprofile::measure(harness, [&]() {
+        pixels = exrprofile::generate_synthetic_pixels(width, height, content, seed, generator_pool);
+    });
+    const auto source = exrprofile::rgba_source("synthetic", pixels, width, height);
+    fmt::print("=== {} frame {}x{}, {} threads per encode / decode\n", exrprofile::content_name(content), width,
+               height, threads);
+    print_bench(fmt::format("generate ({} threads)", hardware), generate, source.raw_bytes());
+
+    auto read_options = exrprofile::ReadOptions{};
+    read_options.file_threads = threads;
+    read_options.quiet = true;
+    Imf::setGlobalThreadCount(threads);
+
+    for (const auto &codec: exrprofile::codec_sweep({}, {})) {
+        const auto name = codec.name();
+        if (!codec_names.empty() && std::find(codec_names.begin(), codec_names.end(), name) == codec_names.end())
+            continue;
+
+        try {
+            // Encode and whole file decode, into and out of memory
+            const auto trial = exrprofile::try_codec(source, codec, threads, harness);
+            print_bench(name + " encode", trial.encodes, source.raw_bytes());
+            print_bench(name + " decode", trial.decodes, source.raw_bytes());
+
+            // One chunk aligned region from an open file, what a region reader does per task. The trial
+            // keeps its bytes to itself, one more encode (not measured) gives us a file.
+            exrprofile::MemoryOStream encoded(name);
+            exrprofile::save_image(source, encoded, codec, threads);
+            exrprofile::MemoryIStream stream(name, encoded.data(), encoded.size());
+            exrprofile::ScanlineFile file(stream, read_options);
+            const Imath::Box2i &dw = file.dataWindow();
+            const int lines = exrprofile::scanlines_per_chunk(file.compression());
+            const int rows = std::min((std::max(region_rows, 1) + lines - 1) / lines * lines, height);
+            const Imath::Box2i region(dw.min, Imath::V2i(dw.max.x, dw.min.y + rows - 1));
+            const auto buffer = exrprofile::buffer_pool().acquire(file.pixel_size() * width * rows);
+            file.set_buffer(buffer.data(), region);
+            const auto partial = exrprofile::measure(harness, [&]() { file.read(region.min.y, region.max.y); });
+            print_bench(fmt::format("{} region ({} rows)", name, rows), partial,
+                        file.pixel_size() * width * rows);
+        } catch (const std::exception &e) {
+            std::cerr << "Error benchmarking " << name << ": " << e.what() << std::endl;
+        }
+    }
+    return 0;
+}
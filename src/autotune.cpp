@@ -0,0 +1,191 @@
+//
+// Created by symek on 5/17/25.
+//
+#include "autotune.h"
+#include "isolate.h"
+#include <cmath>
+#include <limits>
+
+namespace exrprofile {
+
+    std::vector<int> powers_of_two(const int limit) {
+        std::vector<int> values;
+        for (int n = 1; n <= std::max(limit, 1); n *= 2)
+            values.push_back(n);
+        if (values.back() != std::max(limit, 1))
+            values.push_back(limit);
+        return values;
+    }
+
+    namespace {
+
+        TunePoint measure_point(const std::vector<std::string> &files, const ReadOptions &read_options,
+                                const Harness &harness, const int threads, const int workers, const ThreadMode mode) {
+            TunePoint point;
+            point.threads = threads;
+            point.workers = workers;
+            point.mode = mode;
+            ReadOptions options = read_options;
+            options.quiet = true;
+            const auto isolation = mode == ThreadMode::per_file ? Isolation::file : Isolation::none;
+
+            const size_t hardware = std::max(std::thread::hardware_concurrency(), 1u);
+            ThreadPool pool(std::min<size_t>((size_t) workers * threads, hardware));
+            const PoolReader reader = [threads](const std::string &filename, ThreadPool &frame_pool,
+                                                const ReadOptions &frame_options) {
+                return read_frame(filename, threads, frame_pool, frame_options);
+            };
+
+            std::vector<long> pass_fps;   // frames/s x 1000, so the median helper fits
+            for (int pass = 0; pass < harness.warmup + std::max(harness.repetitions, 1); ++pass) {
+                const auto result = isolated_pass(files, threads, workers, pool, options, isolation, reader);
+                if (pass < harness.warmup)
+                    continue;
+                pass_fps.push_back(std::lround(1e3 * (double) files.size() / std::max(ns_to_seconds(result.wall_ns), 1e-9)));
+                for (const auto &frame: result.frames) {
+                    point.frames.push_back(frame[Records::decompression]);
+                    point.latency.add(frame[Records::decompression]);
+                }
+            }
+            point.fps = deref(StatsSummary<long>::compute(pass_fps, true).median) / 1e3;
+            return point;
+        }
+    }
+
+    const char *thread_mode_name(const ThreadMode mode) {
+        return mode == ThreadMode::per_file ? "per-file" : "global";
+    }
+
+    std::string TunePoint::name() const {
+        return fmt::format("t{}xw{}:{}", threads, workers, thread_mode_name(mode));
+    }
+
+    double ScalingFit::predict(const double n) const {
+        return lambda * n / (1.0 + sigma * (n - 1.0) + kappa * n * (n - 1.0));
+    }
+
+    double ScalingFit::peak() const {
+        if (kappa <= 0.0)
+            return std::numeric_limits<double>::infinity();
+        return std::sqrt(std::max(1.0 - sigma, 0.0) / kappa);
+    }
+
+    ScalingFit fit_usl(const std::vector<std::pair<double, double>> &throughput) {
+        ScalingFit fit;
+        fit.points = throughput.size();
+        if (throughput.empty())
+            return fit;
+
+        // With lambda fixed, N lambda / X(N) - 1 = sigma (N - 1) + kappa N (N - 1) is linear in sigma and kappa.
+        // lambda starts as the smallest configuration's per thread throughput and is refined from the fit
+        // (it's only exact when that configuration is a single thread).
+        const auto smallest = *std::min_element(throughput.begin(), throughput.end());
+        fit.lambda = smallest.second / smallest.first;
+        for (int iteration = 0; iteration < 50; ++iteration) {
+            double s11 = 0, s12 = 0, s22 = 0, s1y = 0, s2y = 0;
+            for (const auto &[n, x]: throughput) {
+                if (x <= 0.0) continue;
+                const double y = n * fit.lambda / x - 1.0;
+                const double x1 = n - 1.0, x2 = n * (n - 1.0);
+                s11 += x1 * x1;
+                s12 += x1 * x2;
+                s22 += x2 * x2;
+                s1y += x1 * y;
+                s2y += x2 * y;
+            }
+            const double determinant = s11 * s22 - s12 * s12;
+            const bool solvable = std::fabs(determinant) > 1e-12;
+            if (solvable) {
+                fit.sigma = (s22 * s1y - s12 * s2y) / determinant;
+                fit.kappa = (s11 * s2y - s12 * s1y) / determinant;
+            }
+            // negative coefficients mean the other one explains it alone
+            if (fit.kappa < 0.0 || !solvable) {
+                fit.kappa = 0.0;
+                fit.sigma = s11 > 0 ? s1y / s11 : 0.0;
+            }
+            if (fit.sigma < 0.0) {
+                fit.sigma = 0.0;
+                fit.kappa = s22 > 0 ? std::max(s2y / s22, 0.0) : 0.0;
+            }
+            const double lambda = smallest.second / fit.predict(smallest.first) * fit.lambda;
+            if (smallest.first <= 1.0 || std::fabs(lambda - fit.lambda) <= 1e-9 * fit.lambda)
+                break;
+            fit.lambda = lambda;
+        }
+
+        double mean = 0.0;
+        for (const auto &[n, x]: throughput)
+            mean += x / (double) throughput.size();
+        double residual = 0.0, total = 0.0;
+        for (const auto &[n, x]: throughput) {
+            residual += (x - fit.predict(n)) * (x - fit.predict(n));
+            total += (x - mean) * (x - mean);
+        }
+        fit.r2 = total > 0.0 ? 1.0 - residual / total : 1.0;
+        return fit;
+    }
+
+    std::vector<TunePoint> autotune(const std::vector<std::string> &files, const ReadOptions &read_options,
+                                    const Harness &harness, const TuneOptions &options) {
+        const int hardware = (int) std::max(std::thread::hardware_concurrency(), 1u);
+        const auto threads = options.threads.empty() ? powers_of_two(hardware) : options.threads;
+        const auto workers = options.workers.empty() ? powers_of_two(hardware) : options.workers;
+
+        std::vector<TunePoint> points;
+        for (const auto mode: options.modes) {
+            double best_row = 0.0;
+            for (const int w: workers) {
+                double previous = 0.0, row = 0.0;
+                for (const int t: threads) {
+                    auto point = measure_point(files, read_options, harness, t, w, mode);
+                    fmt::print("{:>20}: {:.2f} fps, mean {:.3f} ms, p99 {:.3f} ms\n", point.name(), point.fps,
+                               ns_to_ms(point.latency.mean), ns_to_ms(point.latency.p99));
+                    const double fps = point.fps;
+                    points.push_back(std::move(point));
+                    row = std::max(row, fps);
+                    if (previous > 0.0 && fps < previous * (1.0 + options.flat))
+                        break;   // more threads per frame stopped paying off
+                    previous = fps;
+                }
+                if (best_row > 0.0 && row < best_row * (1.0 + options.flat))
+                    break;       // so did more frames in flight
+                best_row = std::max(best_row, row);
+            }
+        }
+        return points;
+    }
+
+    void print_tune_report(const std::vector<TunePoint> &points) {
+        if (points.empty())
+            return;
+        const auto best_fps = std::max_element(points.begin(), points.end(),
+                                               [](const auto &a, const auto &b) { return a.fps < b.fps; });
+        const auto best_p99 = std::min_element(points.begin(), points.end(),
+                                               [](const auto &a, const auto &b) { return a.latency.p99 < b.latency.p99; });
+
+        fmt::print("\nScaling model (USL, N = threads x workers):\n");
+        for (const auto mode: {ThreadMode::global, ThreadMode::per_file}) {
+            std::vector<std::pair<double, double>> throughput;
+            for (const auto &point: points)
+                if (point.mode == mode)
+                    throughput.emplace_back((double) point.threads * point.workers, point.fps);
+            if (throughput.empty())
+                continue;
+            const auto fit = fit_usl(throughput);
+            fmt::print("{:>20}: lambda {:.2f} fps, sigma {:.4f}, kappa {:.6f}, R^2 {:.3f} ({} points), ",
+                       thread_mode_name(mode), fit.lambda, fit.sigma, fit.kappa, fit.r2, fit.points);
+            if (std::isinf(fit.peak()))
+                fmt::print("no peak (Amdahl, ceiling {:.2f} fps)\n",
+                           fit.sigma > 0.0 ? fit.lambda / fit.sigma : std::numeric_limits<double>::infinity());
+            else
+                fmt::print("peak at N = {:.1f} ({:.2f} fps)\n", fit.peak(), fit.predict(fit.peak()));
+        }
+
+        fmt::print("\n=== Best throughput: {} -> {:.2f} fps (p99 {:.3f} ms)\n", best_fps->name(), best_fps->fps,
+                   ns_to_ms(best_fps->latency.p99));
+        fmt::print("=== Best p99 latency: {} -> {:.3f} ms ({:.2f} fps)\n", best_p99->name(),
+                   ns_to_ms(best_p99->latency.p99), best_p99->fps);
+    }
+
+} // end of namespace exrprofile
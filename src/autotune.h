@@ -0,0 +1,61 @@
+//
+// Created by symek on 5/17/25.
+//
+#pragma once
+#include <string>
+#include <utility>
+#include <vector>
+#include "mtread.h"
+#include "stats.h"
+
+namespace exrprofile {
+
+    // Who sizes OpenEXR's threads: every frame sets the global count to its threads (global), or the
+    // global pool is sized once for all frames in flight and each file gets its threads in the constructor.
+    enum class ThreadMode { global, per_file };
+    const char *thread_mode_name(ThreadMode mode);
+
+    struct TuneOptions {
+        std::vector<int> threads;   // threads per frame to try, empty: 1, 2, 4 .. cores
+        std::vector<int> workers;   // frames in flight to try, empty: same as threads
+        std::vector<ThreadMode> modes{ThreadMode::global, ThreadMode::per_file};
+        double flat = 0.03;         // a step gaining less throughput than this (3%) ends its direction
+    };
+
+    struct TunePoint {
+        int threads = 1;
+        int workers = 1;
+        ThreadMode mode = ThreadMode::global;
+        double fps = 0.0;               // median of the measured passes
+        StatsSummary<long> latency;     // frame time (ns) over all measured passes
+        Samples frames;
+        std::string name() const;
+    };
+
+    // Universal Scalability Law over N = threads x workers:
+    //   X(N) = lambda N / (1 + sigma (N - 1) + kappa N (N - 1))
+    // sigma is contention (serial fraction), kappa coherency cost. kappa = 0 is Amdahl's law.
+    struct ScalingFit {
+        double lambda = 0.0;   // frames/s of a single thread
+        double sigma = 0.0;
+        double kappa = 0.0;
+        double r2 = 0.0;
+        size_t points = 0;
+
+        double predict(double n) const;
+        double peak() const;   // N of the highest throughput, infinite without coherency cost
+    };
+    // 1, 2, 4 .. up to and including `limit`
+    std::vector<int> powers_of_two(int limit);
+
+    // Least squares fit on (N, frames/s) pairs, needs three distinct N to mean anything.
+    ScalingFit fit_usl(const std::vector<std::pair<double, double>> &throughput);
+
+    // Sweeps workers (outer) x threads (inner) for every thread mode. A direction stops as soon as a
+    // step improves frames/s by less than options.flat. Every configuration runs harness.warmup
+    // unmeasured and harness.repetitions measured passes over the whole file list, on its own pool.
+    std::vector<TunePoint> autotune(const std::vector<std::string> &files, const ReadOptions &read_options,
+                                    const Harness &harness, const TuneOptions &options = {});
+    void print_tune_report(const std::vector<TunePoint> &points);
+
+} // end of namespace exrprofile
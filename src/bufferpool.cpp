@@ -0,0 +1,142 @@
+//
+// Created by symek on 6/28/25.
+//
+#include "bufferpool.h"
+#include "timing.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <fmt/core.h>
+
+namespace exrprofile {
+
+    namespace {
+        constexpr size_t huge_page = 2 * 1024 * 1024;
+        constexpr size_t granularity = 64 * 1024;   // fewer distinct sizes, better reuse
+
+        size_t round_up(const size_t bytes, const size_t to) {
+            return std::max<size_t>((bytes + to - 1) / to * to, to);
+        }
+    }
+
+    BufferPool::Buffer &BufferPool::Buffer::operator=(Buffer &&other) noexcept {
+        if (this != &other) {
+            reset();
+            pool = std::exchange(other.pool, nullptr);
+            bytes = std::exchange(other.bytes, nullptr);
+            capacity = std::exchange(other.capacity, 0);
+            cost = std::exchange(other.cost, 0);
+        }
+        return *this;
+    }
+
+    void BufferPool::Buffer::reset() {
+        if (pool && bytes)
+            pool->release(bytes, capacity);
+        pool = nullptr;
+        bytes = nullptr;
+        capacity = 0;
+        cost = 0;
+    }
+
+    BufferPool::Buffer BufferPool::acquire(const size_t bytes) {
+        Buffer buffer;
+        buffer.pool = this;
+        BufferOptions current;
+        {
+            std::scoped_lock lock(mutex);
+            current = options;
+            // smallest idle buffer that fits, unless it's more than twice what we need
+            const auto found = idle.lower_bound(bytes);
+            if (current.recycle && found != idle.end() && found->first <= 2 * std::max(bytes, granularity)) {
+                buffer.capacity = found->first;
+                buffer.bytes = found->second;
+                idle.erase(found);
+                ++counts.reuses;
+                return buffer;
+            }
+        }
+
+        const size_t align = current.huge_pages ? huge_page : alignment;
+        buffer.capacity = round_up(bytes, current.huge_pages ? huge_page : granularity);
+        const auto start_alloc = Clock::now();
+        buffer.bytes = static_cast<char *>(std::aligned_alloc(align, buffer.capacity));
+        if (!buffer.bytes)
+            throw std::bad_alloc();
+        if (current.huge_pages)
+            ::madvise(buffer.bytes, buffer.capacity, MADV_HUGEPAGE);
+        const long alloc_ns = elapsed_ns(start_alloc);
+
+        // Fault the pages in now, not in the middle of a decode. Without recycling it's a full zero
+        // fill, what a std::vector does.
+        const auto start_touch = Clock::now();
+        if (current.recycle) {
+            const size_t page = current.huge_pages ? huge_page : static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+            for (size_t offset = 0; offset < buffer.capacity; offset += page)
+                static_cast<volatile char *>(buffer.bytes)[offset] = 0;
+        } else {
+            std::memset(buffer.bytes, 0, buffer.capacity);
+        }
+        const long touch_ns = elapsed_ns(start_touch);
+
+        buffer.cost = alloc_ns + touch_ns;
+        std::scoped_lock lock(mutex);
+        ++counts.allocations;
+        counts.alloc_ns += alloc_ns;
+        counts.touch_ns += touch_ns;
+        counts.allocated_bytes += buffer.capacity;
+        return buffer;
+    }
+
+    void BufferPool::release(char *bytes, const size_t capacity) {
+        std::unique_lock lock(mutex);
+        if (options.recycle) {
+            idle.emplace(capacity, bytes);
+            return;
+        }
+        lock.unlock();
+        std::free(bytes);
+    }
+
+    void BufferPool::configure(const BufferOptions new_options) {
+        clear();
+        std::scoped_lock lock(mutex);
+        options = new_options;
+    }
+
+    void BufferPool::clear() {
+        std::multimap<size_t, char *> freed;
+        {
+            std::scoped_lock lock(mutex);
+            freed.swap(idle);
+        }
+        for (const auto &[capacity, bytes]: freed)
+            std::free(bytes);
+    }
+
+    BufferCounters BufferPool::counters() const {
+        std::scoped_lock lock(mutex);
+        return counts;
+    }
+
+    void BufferPool::reset_counters() {
+        std::scoped_lock lock(mutex);
+        counts = BufferCounters{};
+    }
+
+    BufferPool &buffer_pool() {
+        static BufferPool pool;
+        return pool;
+    }
+
+    void print_buffer_counters(const BufferCounters &counters, const BufferOptions &options) {
+        fmt::print("Pixel buffers ({}{}): {} allocated ({:.2f}MB), {} recycled | alloc {:.3f} ms, first touch {:.3f} ms\n",
+                   options.recycle ? "pooled" : "fresh, zero filled", options.huge_pages ? ", huge pages" : "",
+                   counters.allocations, (double) counters.allocated_bytes / (1024 * 1024), counters.reuses,
+                   ns_to_ms(counters.alloc_ns), ns_to_ms(counters.touch_ns));
+    }
+
+} // end of namespace exrprofile
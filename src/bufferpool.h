@@ -0,0 +1,83 @@
+//
+// Created by symek on 6/28/25.
+//
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <utility>
+
+namespace exrprofile {
+
+    struct BufferOptions {
+        bool recycle = true;        // false: a new zero filled buffer per request (a std::vector, as before)
+        bool huge_pages = false;    // 2MB aligned buffers with madvise(MADV_HUGEPAGE)
+    };
+
+    struct BufferCounters {
+        long allocations = 0;
+        long reuses = 0;
+        long alloc_ns = 0;          // allocator calls
+        long touch_ns = 0;          // first touch: faulting the pages in (zero fill without recycling)
+        uint64_t allocated_bytes = 0;
+    };
+
+    // Pixel buffers for frame and region reads. Buffers are 64 byte aligned, never zero filled, and go
+    // back to the pool when their handle dies, so the next region or frame of a similar size gets them
+    // without allocating or faulting pages in again. What allocating and first touching new buffers
+    // costs is counted apart from the reads.
+    class BufferPool {
+    public:
+        static constexpr size_t alignment = 64;
+
+        class Buffer {
+        public:
+            Buffer() = default;
+            Buffer(Buffer &&other) noexcept { *this = std::move(other); }
+            Buffer &operator=(Buffer &&other) noexcept;
+            Buffer(const Buffer &) = delete;
+            Buffer &operator=(const Buffer &) = delete;
+            ~Buffer() { reset(); }
+
+            char *data() const { return bytes; }
+            size_t size() const { return capacity; }
+            long cost_ns() const { return cost; }   // allocation and first touch, 0 when recycled
+            void reset();
+
+        private:
+            friend class BufferPool;
+            BufferPool *pool = nullptr;
+            char *bytes = nullptr;
+            size_t capacity = 0;
+            long cost = 0;
+        };
+
+        explicit BufferPool(BufferOptions options = {}) : options(options) {}
+        ~BufferPool() { clear(); }
+        BufferPool(const BufferPool &) = delete;
+        BufferPool &operator=(const BufferPool &) = delete;
+
+        // At least `bytes`, contents undefined.
+        Buffer acquire(size_t bytes);
+        // Frees the idle buffers and applies new options, counters stay.
+        void configure(BufferOptions new_options);
+        void clear();
+
+        BufferCounters counters() const;
+        void reset_counters();
+
+    private:
+        void release(char *bytes, size_t capacity);
+
+        mutable std::mutex mutex;
+        BufferOptions options;
+        BufferCounters counts;
+        std::multimap<size_t, char *> idle;   // capacity -> buffer
+    };
+
+    // The process wide pool of all readers
+    BufferPool &buffer_pool();
+    void print_buffer_counters(const BufferCounters &counters, const BufferOptions &options);
+
+} // end of namespace exrprofile
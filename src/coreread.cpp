@@ -0,0 +1,346 @@
+//
+// Created by symek on 5/10/25.
+//
+#include "coreread.h"
+#include <OpenEXR/ImfCompression.h>
+#include <bit>
+#include <cmath>
+#include <fstream>
+#include <memory>
+
+namespace exrprofile {
+
+    namespace {
+
+        void check(const exr_result_t rv, const char *what) {
+            if (rv != EXR_ERR_SUCCESS)
+                throw std::runtime_error(fmt::format("{}: {}", what, exr_get_default_error_message(rv)));
+        }
+
+        std::string codec_name(const exr_compression_t compression) {
+            // exr_compression_t and Imf::Compression share their values
+            std::string name;
+            Imf::getCompressionNameFromId(static_cast<Imf::Compression>(compression), name);
+            return name;
+        }
+
+        std::string duration_label(const double ns) {
+            if (ns < 1e3) return fmt::format("{:.0f}ns", ns);
+            if (ns < 1e6) return fmt::format("{:.1f}us", ns / 1e3);
+            return fmt::format("{:.1f}ms", ns / 1e6);
+        }
+
+        // The pipeline's own stages, and how long they took on the current chunk.
+        using Stage = exr_result_t (*)(exr_decode_pipeline_t *);
+        struct ChunkTimer {
+            Stage read = nullptr, decompress = nullptr, unpack = nullptr;
+            long read_ns = 0, decompress_ns = 0, unpack_ns = 0;
+        };
+
+        template<Stage ChunkTimer::*Inner, long ChunkTimer::*Total>
+        exr_result_t timed_stage(exr_decode_pipeline_t *decode) {
+            auto *timer = static_cast<ChunkTimer *>(decode->decoding_user_data);
+            const auto start = Clock::now();
+            const exr_result_t rv = (timer->*Inner)(decode);
+            timer->*Total += elapsed_ns(start);
+            return rv;
+        }
+
+        // Puts a timed wrapper in front of a stage Core picked (stages it skips stay empty).
+        template<Stage exr_decode_pipeline_t::*Slot, Stage ChunkTimer::*Inner, long ChunkTimer::*Total>
+        void hook(exr_decode_pipeline_t &decode, ChunkTimer &timer) {
+            constexpr Stage wrapper = &timed_stage<Inner, Total>;
+            if (decode.*Slot == nullptr || decode.*Slot == wrapper)
+                return;
+            timer.*Inner = decode.*Slot;
+            decode.*Slot = wrapper;
+        }
+
+        // Decode pipeline of one reader for one part, reused for every chunk it takes.
+        class ChunkDecoder {
+        public:
+            ChunkDecoder(exr_const_context_t context, const int part) : context(context), part(part) {}
+            ~ChunkDecoder() {
+                if (initialized)
+                    exr_decoding_destroy(context, &decode);
+            }
+            ChunkDecoder(const ChunkDecoder &) = delete;
+            ChunkDecoder &operator=(const ChunkDecoder &) = delete;
+
+            ChunkRecord run(const exr_chunk_info_t &chunk) {
+                check(initialized ? exr_decoding_update(context, part, &chunk, &decode)
+                                  : exr_decoding_initialize(context, part, &chunk, &decode), "decoding setup");
+                initialized = true;
+
+                // channels unpacked planar in their file types, one after another
+                size_t bytes = 0;
+                for (int c = 0; c < decode.channel_count; ++c) {
+                    const auto &channel = decode.channels[c];
+                    bytes += static_cast<size_t>(channel.height) * channel.width * channel.user_bytes_per_element;
+                }
+                if (buffer.size() < bytes)
+                    buffer.resize(bytes);
+                uint8_t *out = buffer.data();
+                for (int c = 0; c < decode.channel_count; ++c) {
+                    auto &channel = decode.channels[c];
+                    channel.decode_to_ptr = out;
+                    channel.user_pixel_stride = channel.user_bytes_per_element;
+                    channel.user_line_stride = channel.width * channel.user_bytes_per_element;
+                    out += static_cast<size_t>(channel.height) * channel.user_line_stride;
+                }
+
+                check(exr_decoding_choose_default_routines(context, part, &decode), "decoding routines");
+                timer.read_ns = timer.decompress_ns = timer.unpack_ns = 0;
+                decode.decoding_user_data = &timer;
+                hook<&exr_decode_pipeline_t::read_fn, &ChunkTimer::read, &ChunkTimer::read_ns>(decode, timer);
+                hook<&exr_decode_pipeline_t::decompress_fn, &ChunkTimer::decompress, &ChunkTimer::decompress_ns>(decode, timer);
+                hook<&exr_decode_pipeline_t::unpack_and_convert_fn, &ChunkTimer::unpack, &ChunkTimer::unpack_ns>(decode, timer);
+                check(exr_decoding_run(context, part, &decode), "decoding");
+
+                ChunkRecord record;
+                record.part = part;
+                record.index = chunk.idx;
+                record.x = chunk.start_x;
+                record.y = chunk.start_y;
+                record.level_x = chunk.level_x;
+                record.level_y = chunk.level_y;
+                record.compression = static_cast<exr_compression_t>(chunk.compression);
+                record.packed_bytes = chunk.packed_size;
+                record.unpacked_bytes = chunk.unpacked_size;
+                record.read_ns = timer.read_ns;
+                record.decompress_ns = timer.decompress_ns;
+                record.unpack_ns = timer.unpack_ns;
+                return record;
+            }
+
+        private:
+            exr_const_context_t context;
+            int part;
+            exr_decode_pipeline_t decode = EXR_DECODE_PIPELINE_INITIALIZER;
+            bool initialized = false;
+            ChunkTimer timer;
+            std::vector<uint8_t> buffer;
+        };
+
+        struct CoreChunk {
+            int part = 0;
+            exr_chunk_info_t info{};
+        };
+
+        // Every chunk of the file in file order, tiles of all (or options.level) levels.
+        std::vector<CoreChunk> list_chunks(exr_const_context_t context, const ReadOptions &options) {
+            std::vector<CoreChunk> chunks;
+            int parts = 0;
+            check(exr_get_count(context, &parts), "part count");
+            for (int p = 0; p < parts; ++p) {
+                exr_storage_t storage;
+                check(exr_get_storage(context, p, &storage), "storage");
+                if (storage == EXR_STORAGE_DEEP_SCANLINE || storage == EXR_STORAGE_DEEP_TILED) {
+                    if (!options.quiet)
+                        fmt::print("{:>15}: part {} is deep, skipped\n", "core", p);
+                    continue;
+                }
+
+                CoreChunk chunk{p};
+                if (storage == EXR_STORAGE_SCANLINE) {
+                    exr_attr_box2i_t dw;
+                    int32_t lines = 1;
+                    check(exr_get_data_window(context, p, &dw), "data window");
+                    check(exr_get_scanlines_per_chunk(context, p, &lines), "scanlines per chunk");
+                    for (int y = dw.min.y; y <= dw.max.y; y += lines) {
+                        check(exr_read_scanline_chunk_info(context, p, y, &chunk.info), "chunk info");
+                        chunks.push_back(chunk);
+                    }
+                    continue;
+                }
+
+                uint32_t tile_x, tile_y;
+                exr_tile_level_mode_t level_mode;
+                exr_tile_round_mode_t round_mode;
+                int32_t levels_x = 1, levels_y = 1;
+                check(exr_get_tile_descriptor(context, p, &tile_x, &tile_y, &level_mode, &round_mode), "tile descriptor");
+                check(exr_get_tile_levels(context, p, &levels_x, &levels_y), "tile levels");
+                for (int ly = 0; ly < levels_y; ++ly) {
+                    for (int lx = 0; lx < levels_x; ++lx) {
+                        if (level_mode != EXR_TILE_RIPMAP_LEVELS && lx != ly)
+                            continue;
+                        if (options.level >= 0 && (lx != options.level || ly != options.level))
+                            continue;
+                        int32_t count_x = 0, count_y = 0;
+                        check(exr_get_tile_counts(context, p, lx, ly, &count_x, &count_y), "tile counts");
+                        for (int ty = 0; ty < count_y; ++ty)
+                            for (int tx = 0; tx < count_x; ++tx) {
+                                check(exr_read_tile_chunk_info(context, p, tx, ty, lx, ly, &chunk.info), "chunk info");
+                                chunks.push_back(chunk);
+                            }
+                    }
+                }
+            }
+            return chunks;
+        }
+    }
+
+    void Histogram::add(const long ns) {
+        const auto bucket = std::bit_width(static_cast<unsigned long>(std::max(ns, 0L)));
+        ++buckets[std::min<size_t>(bucket, buckets.size() - 1)];
+    }
+
+    void Histogram::merge(const Histogram &other) {
+        for (size_t i = 0; i < buckets.size(); ++i)
+            buckets[i] += other.buckets[i];
+    }
+
+    void CodecProfile::add(const ChunkRecord &chunk) {
+        ++chunks;
+        packed_bytes += chunk.packed_bytes;
+        unpacked_bytes += chunk.unpacked_bytes;
+        read_ns += chunk.read_ns;
+        decompress_ns += chunk.decompress_ns;
+        unpack_ns += chunk.unpack_ns;
+        read.add(chunk.read_ns);
+        decompress.add(chunk.decompress_ns);
+        unpack.add(chunk.unpack_ns);
+    }
+
+    void CodecProfile::merge(const CodecProfile &other) {
+        chunks += other.chunks;
+        packed_bytes += other.packed_bytes;
+        unpacked_bytes += other.unpacked_bytes;
+        read_ns += other.read_ns;
+        decompress_ns += other.decompress_ns;
+        unpack_ns += other.unpack_ns;
+        read.merge(other.read);
+        decompress.merge(other.decompress);
+        unpack.merge(other.unpack);
+    }
+
+    void CoreProfile::merge(const std::map<std::string, CodecProfile> &more, std::vector<ChunkRecord> &&records) {
+        std::scoped_lock lock(mutex);
+        for (const auto &[name, codec]: more)
+            codecs[name].merge(codec);
+        if (keep_chunks)
+            chunks.insert(chunks.end(), std::make_move_iterator(records.begin()), std::make_move_iterator(records.end()));
+    }
+
+    Stats core_read(const std::string &filename, const int num_threads, ThreadPool &pool, const ReadOptions &options,
+                    CoreProfile *profile) {
+
+        if (!options.quiet)
+            std::cout << "Using " << num_threads << " Core API readers." << std::endl;
+        Stats result{};
+        exr_context_t context = nullptr;
+
+        try {
+            const auto start_open = Clock::now();
+            const exr_context_initializer_t initializer = EXR_DEFAULT_CONTEXT_INITIALIZER;
+            check(exr_start_read(&context, filename.c_str(), &initializer), "exr_start_read");
+            const auto chunks = list_chunks(context, options);
+            const auto open_time = elapsed_ns(start_open);
+
+            WorkCursor<CoreChunk> cursor(chunks);
+            CoreProfile frame;
+            frame.keep_chunks = profile && profile->keep_chunks;
+            TaskGroup readers;
+
+            const auto start_decompress = Clock::now();
+            const size_t reader_count = std::min<size_t>(std::max(num_threads, 1), chunks.size());
+            for (size_t i = 0; i < reader_count; ++i) {
+                pool.enqueue(readers, [&]() {
+                    try {
+                        // a pipeline per part, the context itself is safe to share
+                        std::map<int, std::unique_ptr<ChunkDecoder>> decoders;
+                        std::map<std::string, CodecProfile> codecs;
+                        std::vector<ChunkRecord> records;
+                        CoreChunk chunk;
+                        while (cursor.take(chunk)) {
+                            auto &decoder = decoders[chunk.part];
+                            if (!decoder)
+                                decoder = std::make_unique<ChunkDecoder>(context, chunk.part);
+                            auto record = decoder->run(chunk.info);
+                            codecs[codec_name(record.compression)].add(record);
+                            if (frame.keep_chunks) {
+                                record.filename = filename;
+                                records.push_back(std::move(record));
+                            }
+                        }
+                        frame.merge(codecs, std::move(records));
+                    } catch (const std::exception &e) {
+                        std::cerr << "Error decoding EXR chunk: " << e.what() << std::endl;
+                    }
+                });
+            }
+            pool.wait(readers);
+            const auto decompression_ns = elapsed_ns(start_decompress) + open_time;
+
+            CodecProfile total;
+            for (const auto &[name, codec]: frame.codecs)
+                total.merge(codec);
+            if (!options.quiet) {
+                fmt::print("{:>15}: {:.6f} seconds\n", "decompression", ns_to_seconds(decompression_ns));
+                fmt::print("{:>15}: {:.3f} ms\n", "setup", ns_to_ms(open_time));
+                fmt::print("{:>15}: {} of {} chunks, {:.2f}MB in -> {:.2f}MB out (read {:.3f} ms, decompress {:.3f} ms,"
+                           " unpack {:.3f} ms over all readers)\n", "chunks", total.chunks, chunks.size(),
+                           (double) total.packed_bytes / (1024 * 1024), (double) total.unpacked_bytes / (1024 * 1024),
+                           ns_to_ms(total.read_ns), ns_to_ms(total.decompress_ns), ns_to_ms(total.unpack_ns));
+            }
+            result[Records::decompression] = decompression_ns;
+            result[Records::setup] = open_time;
+
+            if (profile)
+                profile->merge(frame.codecs, std::move(frame.chunks));
+
+        } catch (const std::exception &e) {
+            std::cerr << "Error reading EXR file: " << e.what() << std::endl;
+        }
+        if (context)
+            exr_finish(&context);
+        return result;
+    }
+
+    void print_core_profile(const CoreProfile &profile, const bool histograms) {
+        fmt::print("\nPer chunk breakdown (Core API, times summed over readers):\n");
+        for (const auto &[name, codec]: profile.codecs) {
+            if (codec.chunks == 0) continue;
+            const double chunks = static_cast<double>(codec.chunks);
+            const double total = std::max<double>(codec.read_ns + codec.decompress_ns + codec.unpack_ns, 1.0);
+            fmt::print("{:>15}: {} chunks, {:.1f}KB in -> {:.1f}KB out per chunk ({:.2f}x) | read {:.3f} ms ({:.1f}%)"
+                       " | decompress {:.3f} ms ({:.1f}%) | unpack {:.3f} ms ({:.1f}%)\n",
+                       name, codec.chunks, codec.packed_bytes / chunks / 1024, codec.unpacked_bytes / chunks / 1024,
+                       (double) codec.unpacked_bytes / std::max<uint64_t>(codec.packed_bytes, 1),
+                       ns_to_ms(codec.read_ns), 100.0 * codec.read_ns / total,
+                       ns_to_ms(codec.decompress_ns), 100.0 * codec.decompress_ns / total,
+                       ns_to_ms(codec.unpack_ns), 100.0 * codec.unpack_ns / total);
+            if (!histograms) continue;
+
+            size_t first = codec.read.buckets.size(), last = 0;
+            for (size_t i = 0; i < codec.read.buckets.size(); ++i) {
+                if (codec.read.buckets[i] + codec.decompress.buckets[i] + codec.unpack.buckets[i] == 0) continue;
+                first = std::min(first, i);
+                last = i;
+            }
+            fmt::print("{:>25} {:>10} {:>10} {:>10}\n", "chunk time", "read", "decompress", "unpack");
+            for (size_t i = first; i <= last && first < codec.read.buckets.size(); ++i) {
+                const auto label = i == 0 ? std::string{"0"} : "< " + duration_label(std::ldexp(1.0, (int) i));
+                fmt::print("{:>25} {:>10} {:>10} {:>10}\n", label, codec.read.buckets[i],
+                           codec.decompress.buckets[i], codec.unpack.buckets[i]);
+            }
+        }
+    }
+
+    void write_chunk_csv(const std::string &path, const CoreProfile &profile) {
+        std::ofstream file(path);
+        if (!file.is_open())
+            throw std::runtime_error("Could not write chunks: " + path);
+        file << "name,part,chunk,x,y,level_x,level_y,codec,packed_bytes,unpacked_bytes,read_ns,decompress_ns,unpack_ns\n";
+        for (const auto &chunk: profile.chunks) {
+            std::string name = chunk.filename;
+            for (size_t at = name.find('"'); at != std::string::npos; at = name.find('"', at + 2))
+                name.insert(at, 1, '"');
+            file << '"' << name << "\"," << chunk.part << ',' << chunk.index << ',' << chunk.x << ',' << chunk.y << ','
+                 << chunk.level_x << ',' << chunk.level_y << ',' << codec_name(chunk.compression) << ','
+                 << chunk.packed_bytes << ',' << chunk.unpacked_bytes << ',' << chunk.read_ns << ','
+                 << chunk.decompress_ns << ',' << chunk.unpack_ns << '\n';
+        }
+    }
+
+} // end of namespace exrprofile
@@ -0,0 +1,70 @@
+//
+// Created by symek on 5/10/25.
+//
+#pragma once
+#include <OpenEXR/openexr.h>
+#include <array>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "mtread.h"
+
+namespace exrprofile {
+
+    // Counts of chunk timings in power of two buckets: bucket k holds [2^(k-1), 2^k) ns.
+    struct Histogram {
+        std::array<long, 64> buckets{};
+        void add(long ns);
+        void merge(const Histogram &other);
+    };
+
+    // One decoded chunk (scanline block or tile), times in ns.
+    struct ChunkRecord {
+        std::string filename;
+        int part = 0;
+        int index = 0;
+        int x = 0, y = 0;
+        int level_x = 0, level_y = 0;
+        exr_compression_t compression = EXR_COMPRESSION_NONE;
+        uint64_t packed_bytes = 0;     // bytes in, as stored in the file
+        uint64_t unpacked_bytes = 0;   // bytes out, after decompression
+        long read_ns = 0;              // fetching the raw chunk
+        long decompress_ns = 0;        // codec
+        long unpack_ns = 0;            // unpack / convert into the frame buffer
+    };
+
+    struct CodecProfile {
+        long chunks = 0;
+        uint64_t packed_bytes = 0;
+        uint64_t unpacked_bytes = 0;
+        long read_ns = 0, decompress_ns = 0, unpack_ns = 0;
+        Histogram read, decompress, unpack;
+
+        void add(const ChunkRecord &chunk);
+        void merge(const CodecProfile &other);
+    };
+
+    // Per codec totals of all frames read through the Core API, shared by the frame workers.
+    struct CoreProfile {
+        std::mutex mutex;
+        std::map<std::string, CodecProfile> codecs;
+        bool keep_chunks = false;          // also keep every ChunkRecord (for --chunk-csv)
+        std::vector<ChunkRecord> chunks;
+
+        void merge(const std::map<std::string, CodecProfile> &more, std::vector<ChunkRecord> &&records);
+    };
+
+    // Reads all scanline and tiled parts of a file chunk by chunk with the OpenEXR Core API
+    // (exr_decode_pipeline), timing read, decompress and unpack of every chunk. Chunks are spread
+    // over num_threads readers on the pool, all decoding from one shared context. Channels are
+    // unpacked in their file pixel types, deep parts are skipped, options.level narrows tiled parts
+    // down to one level. Core reads the file itself, the stream backend and cache mode don't apply.
+    // Returns decompression and setup times (ns), adds the chunks to `profile` if given.
+    Stats core_read(const std::string &filename, int num_threads, ThreadPool &pool, const ReadOptions &options = {},
+                    CoreProfile *profile = nullptr);
+
+    void print_core_profile(const CoreProfile &profile, bool histograms = true);
+    void write_chunk_csv(const std::string &path, const CoreProfile &profile);
+
+} // end of namespace exrprofile
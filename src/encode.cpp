@@ -0,0 +1,156 @@
+//
+// Created by symek on 6/7/25.
+//
+#include "encode.h"
+#include "timing.h"
+#include <OpenEXR/ImfInputFile.h>
+#include <OpenEXR/ImfOutputFile.h>
+#include <OpenEXR/ImfStdIO.h>
+#include <OpenEXR/ImfChannelList.h>
+#include <OpenEXR/ImfPartType.h>
+#include <OpenEXR/ImfCompression.h>
+#include <algorithm>
+#include <stdexcept>
+#include <fmt/core.h>
+
+namespace exrprofile {
+
+    namespace {
+        bool zip_like(const Imf::Compression compression) {
+            return compression == Imf::ZIPS_COMPRESSION || compression == Imf::ZIP_COMPRESSION;
+        }
+
+        bool dwa_like(const Imf::Compression compression) {
+            return compression == Imf::DWAA_COMPRESSION || compression == Imf::DWAB_COMPRESSION;
+        }
+    }
+
+    std::string CodecSetting::name() const {
+        std::string codec;
+        Imf::getCompressionNameFromId(compression, codec);
+        if (zip_level >= 0)
+            return fmt::format("{}:{}", codec, zip_level);
+        if (dwa_level >= 0.0f)
+            return fmt::format("{}:{:g}", codec, dwa_level);
+        return codec;
+    }
+
+    std::string CodecSetting::file_tag() const {
+        auto tag = name();
+        std::replace(tag.begin(), tag.end(), ':', '_');
+        return tag;
+    }
+
+    std::vector<CodecSetting> codec_sweep(const std::vector<int> &zip_levels, const std::vector<float> &dwa_levels) {
+        std::vector<CodecSetting> sweep;
+        for (int id = 0; id < Imf::NUM_COMPRESSION_METHODS; ++id) {
+            const auto compression = static_cast<Imf::Compression>(id);
+            sweep.push_back(CodecSetting{compression});
+            if (zip_like(compression))
+                for (const int level: zip_levels)
+                    sweep.push_back(CodecSetting{compression, std::clamp(level, 0, 9)});
+            if (dwa_like(compression))
+                for (const float level: dwa_levels)
+                    sweep.push_back(CodecSetting{compression, -1, std::max(level, 0.0f)});
+        }
+        return sweep;
+    }
+
+    size_t SourceImage::raw_bytes() const {
+        const Imath::Box2i &dw = header.dataWindow();
+        return static_cast<size_t>(dw.max.x - dw.min.x + 1) * (dw.max.y - dw.min.y + 1) * layout.pixel_size;
+    }
+
+    SourceImage load_source(const std::string &filename) {
+        Imf::InputFile file(filename.c_str());
+        const Imf::Header &input = file.header();
+        if (input.hasType() && Imf::isDeepData(input.type()))
+            throw std::runtime_error("Deep images can't be re-encoded: " + filename);
+
+        SourceImage image;
+        image.name = filename;
+        image.layout = layout_for(input.channels());
+        image.header = input;
+
+        // Only what we are going to write stays in the header: full resolution channels of one scanline part.
+        Imf::ChannelList channels;
+        for (const auto &[name, type]: image.layout.channels)
+            channels.insert(name, Imf::Channel(type));
+        image.header.channels() = channels;
+        if (image.header.hasTileDescription())
+            image.header.erase("tiles");
+        if (image.header.hasType())
+            image.header.setType(Imf::SCANLINEIMAGE);
+        image.header.erase("chunkCount");
+        if (image.header.lineOrder() == Imf::RANDOM_Y)
+            image.header.lineOrder() = Imf::INCREASING_Y;
+
+        image.storage.resize(image.raw_bytes());
+        image.pixels = image.storage.data();
+        const Imath::Box2i &dw = input.dataWindow();
+        file.setFrameBuffer(frame_buffer_for(image.layout, dw, image.storage.data()));
+        file.readPixels(dw.min.y, dw.max.y);
+        return image;
+    }
+
+    SourceImage rgba_source(const std::string &name, const std::vector<Imf::Rgba> &pixels, const int width,
+                            const int height) {
+        SourceImage image;
+        image.name = name;
+        image.header = Imf::Header(width, height);
+        // same memory order as Imf::Rgba
+        for (const char *channel: {"R", "G", "B", "A"}) {
+            image.layout.channels.emplace_back(channel, Imf::HALF);
+            image.header.channels().insert(channel, Imf::Channel(Imf::HALF));
+        }
+        image.layout.pixel_size = sizeof(Imf::Rgba);
+        image.pixels = reinterpret_cast<const char *>(pixels.data());
+        return image;
+    }
+
+    const char *encode_target_name(const EncodeTarget target) {
+        switch (target) {
+            case EncodeTarget::fsync: return "fsync";
+            case EncodeTarget::memory: return "memory";
+            default: return "disk";
+        }
+    }
+
+    void save_image(const SourceImage &image, Imf::OStream &stream, const CodecSetting &codec, const int threads) {
+        Imf::Header header = image.header;
+        header.compression() = codec.compression;
+        if (codec.zip_level >= 0)
+            header.zipCompressionLevel() = codec.zip_level;
+        if (codec.dwa_level >= 0.0f)
+            header.dwaCompressionLevel() = codec.dwa_level;
+
+        const Imath::Box2i &dw = header.dataWindow();
+        Imf::OutputFile file(stream, header, threads);
+        // OutputFile only reads from the frame buffer
+        file.setFrameBuffer(frame_buffer_for(image.layout, dw, const_cast<char *>(image.pixels)));
+        file.writePixels(dw.max.y - dw.min.y + 1);
+    }
+
+    void save_image(const SourceImage &image, const std::string &filename, const CodecSetting &codec,
+                    const int threads) {
+        Imf::StdOFStream stream(filename.c_str());
+        save_image(image, stream, codec, threads);
+    }
+
+    void print_codec_totals(const std::map<std::string, CodecTotals> &totals) {
+        std::vector<std::pair<std::string, CodecTotals>> sorted(totals.begin(), totals.end());
+        std::sort(sorted.begin(), sorted.end(),
+                  [](const auto &a, const auto &b) { return a.second.file_bytes < b.second.file_bytes; });
+
+        fmt::print("\nAll sources, sorted by size:\n");
+        for (const auto &[name, total]: sorted) {
+            const double raw_mb = (double) total.raw_bytes / (1024 * 1024);
+            fmt::print("{:>25}: {:.2f}MB ({:.2f}x) -> encode {:.1f} MB/s, decode {:.1f} MB/s\n", name,
+                       (double) total.file_bytes / (1024 * 1024),
+                       (double) total.raw_bytes / std::max<uint64_t>(total.file_bytes, 1),
+                       raw_mb / std::max(ns_to_seconds(total.encode_ns), 1e-9),
+                       raw_mb / std::max(ns_to_seconds(total.decode_ns), 1e-9));
+        }
+    }
+
+} // end of namespace exrprofile
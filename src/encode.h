@@ -0,0 +1,72 @@
+//
+// Created by symek on 6/7/25.
+//
+#pragma once
+#include <OpenEXR/ImfHeader.h>
+#include <OpenEXR/ImfIO.h>
+#include <OpenEXR/ImfRgba.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "framebuffer.h"
+
+namespace exrprofile {
+
+    // One entry of the compression sweep: a codec at its default setting, or at a given ZIP / DWA level.
+    struct CodecSetting {
+        Imf::Compression compression = Imf::NO_COMPRESSION;
+        int zip_level = -1;       // ZIPS, ZIP (0-9, -1 library default)
+        float dwa_level = -1.0f;  // DWAA, DWAB (-1 library default, 45)
+
+        std::string name() const;       // "ZIP", "ZIP:9", "DWAA:90"
+        std::string file_tag() const;   // name() usable in a file name
+    };
+
+    // Every Imf::Compression at its default, plus one entry per level for the ZIP and DWA codecs.
+    std::vector<CodecSetting> codec_sweep(const std::vector<int> &zip_levels, const std::vector<float> &dwa_levels);
+
+    // A frame to encode: header (channels, windows, attributes) and its data window pixels,
+    // interleaved as `layout` says. Move only, `pixels` may point into `storage`.
+    struct SourceImage {
+        std::string name;
+        Imf::Header header;
+        PixelLayout layout;
+        const char *pixels = nullptr;
+        std::vector<char> storage;
+
+        SourceImage() = default;
+        SourceImage(SourceImage &&) = default;
+        SourceImage &operator=(SourceImage &&) = default;
+        SourceImage(const SourceImage &) = delete;
+        SourceImage &operator=(const SourceImage &) = delete;
+
+        size_t raw_bytes() const;
+    };
+
+    // First part of a file, full resolution channels in their own pixel types. Tiled files come back
+    // with a scanline header (level 0 only), subsampled channels are dropped, deep files are refused.
+    SourceImage load_source(const std::string &filename);
+    // RGBA half pixels as a source (a view, the vector has to outlive it).
+    SourceImage rgba_source(const std::string &name, const std::vector<Imf::Rgba> &pixels, int width, int height);
+
+    // Where compression sweep frames are written
+    enum class EncodeTarget {
+        disk,    // a file, timing ends when OpenEXR closes it (the data may still be in the page cache)
+        fsync,   // a file, plus fsync of it and its directory, the durable write
+        memory   // a growable buffer, decoded from there too: pure codec throughput
+    };
+    const char *encode_target_name(EncodeTarget target);
+
+    void save_image(const SourceImage &image, Imf::OStream &stream, const CodecSetting &codec, int threads);
+    void save_image(const SourceImage &image, const std::string &filename, const CodecSetting &codec, int threads);
+
+    // Sums of one codec setting over all sources, to pick a codec for a whole set of plates.
+    struct CodecTotals {
+        uint64_t raw_bytes = 0;
+        uint64_t file_bytes = 0;
+        long encode_ns = 0;
+        long decode_ns = 0;
+    };
+    void print_codec_totals(const std::map<std::string, CodecTotals> &totals);
+
+} // end of namespace exrprofile
@@ -0,0 +1,198 @@
+//
+// Created by symek on 7/26/25.
+//
+#include "encodesweep.h"
+#include "streams.h"
+#include "threadpool.h"
+#include <OpenEXR/ImfThreading.h>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <iostream>
+#include <fmt/core.h>
+
+namespace exrprofile {
+
+    namespace {
+
+        double mb_per_second(const uint64_t bytes, const double ns) {
+            return (double) bytes / (1024 * 1024) / std::max(ns_to_seconds(ns), 1e-9);
+        }
+
+        double median_ns(const Samples &samples) {
+            return samples.empty() ? 0.0 : (double) deref(StatsSummary<long>::compute(samples, true).median);
+        }
+
+        EncodeScaling scaling_run(const SourceImage &source, const CodecSetting &codec,
+                                  const std::vector<int> &threads, const Harness &harness) {
+            EncodeScaling scaling;
+            scaling.codec = codec.name();
+            scaling.threads = threads;
+            MemoryOStream encoded(codec.name());
+            std::vector<std::pair<double, double>> throughput;
+            for (const int count: threads) {
+                Imf::setGlobalThreadCount(count);
+                scaling.encodes.push_back(measure(harness, [&]() {
+                    encoded.clear();
+                    save_image(source, encoded, codec, count);
+                }));
+                throughput.emplace_back(count, mb_per_second(source.raw_bytes(), median_ns(scaling.encodes.back())));
+            }
+            scaling.fit = fit_usl(throughput);
+            return scaling;
+        }
+
+        // Every stream (a task on the scheduler) keeps taking the next frame of `jobs` and keeps its
+        // frame times to itself until the run is over.
+        ConcurrentEncode concurrent_run(const std::string &name, const SourceImage &source,
+                                        const std::vector<const CodecSetting *> &jobs, const int streams,
+                                        const int threads, const EncodeTarget target, const std::string &prefix) {
+            ConcurrentEncode run;
+            run.name = name;
+            run.streams = streams;
+            run.threads = threads;
+
+            Imf::setGlobalThreadCount(streams * threads);
+            ThreadPool pool(streams);
+            std::vector<Samples> stream_frames(streams);
+            std::vector<std::string> files(streams);
+            std::atomic<size_t> next{0};
+
+            const auto start = Clock::now();
+            TaskGroup encoders;
+            for (int stream = 0; stream < streams; ++stream) {
+                pool.enqueue(encoders, [&, stream]() {
+                    MemoryOStream encoded(name);
+                    files[stream] = fmt::format("{}stream{}_{}.exr", prefix, stream, run.name);
+                    for (size_t job = next.fetch_add(1); job < jobs.size(); job = next.fetch_add(1)) {
+                        const auto start_frame = Clock::now();
+                        try {
+                            if (target == EncodeTarget::memory) {
+                                encoded.clear();
+                                save_image(source, encoded, *jobs[job], threads);
+                            } else {
+                                save_image(source, files[stream], *jobs[job], threads);
+                                if (target == EncodeTarget::fsync)
+                                    sync_file(files[stream]);
+                            }
+                            // failed frames count neither as time nor as bytes
+                            stream_frames[stream].push_back(elapsed_ns(start_frame));
+                        } catch (const std::exception &e) {
+                            std::cerr << "Error encoding " << jobs[job]->name() << ": " << e.what() << std::endl;
+                        }
+                    }
+                });
+            }
+            pool.wait(encoders);
+            run.wall_ns = elapsed_ns(start);
+
+            for (int stream = 0; stream < streams; ++stream) {
+                run.frames.insert(run.frames.end(), stream_frames[stream].begin(), stream_frames[stream].end());
+                run.raw_bytes += source.raw_bytes() * stream_frames[stream].size();
+                if (target != EncodeTarget::memory) {
+                    std::error_code error;
+                    std::filesystem::remove(files[stream], error);
+                }
+            }
+            return run;
+        }
+    }
+
+    CodecTrial try_codec(const SourceImage &source, const CodecSetting &codec, const int threads,
+                         const Harness &harness, ThreadPool *verify_pool) {
+        CodecTrial trial;
+        trial.codec = codec;
+        MemoryOStream encoded(codec.name());
+        trial.encodes = measure(harness, [&]() {
+            encoded.clear();
+            save_image(source, encoded, codec, threads);
+        });
+        trial.bytes = encoded.size();
+
+        BufferPool::Buffer decoded;
+        trial.decodes = measure(harness, [&]() {
+            MemoryIStream stream(codec.name(), encoded.data(), encoded.size());
+            decoded = decode_pixels(stream, source, threads);
+        });
+        if (verify_pool)
+            trial.error = compare_pixels(source, decoded.data(), *verify_pool);
+        return trial;
+    }
+
+    double ConcurrentEncode::mb_per_second() const {
+        return exrprofile::mb_per_second(raw_bytes, (double) wall_ns);
+    }
+
+    EncodeSweep encode_sweep(const SourceImage &source, const std::vector<CodecSetting> &codecs, const int threads,
+                             const EncodeTarget target, const std::string &prefix, const Harness &harness,
+                             const EncodeSweepOptions &options) {
+        const int hardware = (int) std::max(std::thread::hardware_concurrency(), 1u);
+        const auto thread_counts = options.threads.empty() ? powers_of_two(hardware) : options.threads;
+        const int streams = options.streams > 0 ? options.streams : hardware;
+        const size_t frames = options.frames > 0 ? options.frames : 2 * streams;
+        const int previous = Imf::globalThreadCount();
+
+        EncodeSweep sweep;
+        sweep.frame_bytes = source.raw_bytes();
+        for (const auto &codec: codecs) {
+            fmt::print("{:>15}: encode scaling over {} thread counts, {} streams x {} threads\n", codec.name(),
+                       thread_counts.size(), streams, std::max(threads, 1));
+            sweep.scaling.push_back(scaling_run(source, codec, thread_counts, harness));
+            const std::vector<const CodecSetting *> jobs(frames, &codec);
+            sweep.concurrent.push_back(concurrent_run(codec.file_tag(), source, jobs, streams, std::max(threads, 1),
+                                                      target, prefix));
+            sweep.concurrent.back().name = codec.name();
+        }
+
+        // All codecs at once, in turns, the way a farm writes different passes
+        std::vector<const CodecSetting *> mixed;
+        for (size_t i = 0; i < std::max(frames, codecs.size()) && !codecs.empty(); ++i)
+            mixed.push_back(&codecs[i % codecs.size()]);
+        if (!mixed.empty())
+            sweep.concurrent.push_back(concurrent_run("mixed", source, mixed, streams, std::max(threads, 1), target,
+                                                      prefix));
+
+        Imf::setGlobalThreadCount(previous);
+        return sweep;
+    }
+
+    void print_encode_sweep(const std::string &title, const EncodeSweep &sweep) {
+        if (sweep.scaling.empty())
+            return;
+        fmt::print("\nEncode scaling of {} (MB/s of raw pixels, one frame at a time, in memory):\n", title);
+        std::string header = fmt::format("{:>15} ", "threads");
+        for (const int count: sweep.scaling.front().threads)
+            header += fmt::format("| {:>8} ", count);
+        fmt::print("{}| USL sigma, kappa\n", header);
+        for (const auto &scaling: sweep.scaling) {
+            std::string line = fmt::format("{:>15} ", scaling.codec);
+            for (const auto &encodes: scaling.encodes)
+                line += fmt::format("| {:>8.1f} ", mb_per_second(sweep.frame_bytes, median_ns(encodes)));
+            if (scaling.fit.points >= 3)
+                line += fmt::format("| {:.3f}, {:.4f}", scaling.fit.sigma, scaling.fit.kappa);
+            fmt::print("{}\n", line);
+        }
+
+        const auto &first = sweep.concurrent.front();
+        fmt::print("\nConcurrent encodes of {} ({} streams x {} threads):\n", title, first.streams, first.threads);
+        for (const auto &run: sweep.concurrent) {
+            const auto frame = StatsSummary<long>::compute(run.frames, true);
+            fmt::print("{:>15}: {:>8.1f} MB/s aggregate | frame median {:.3f} ms, p99 {:.3f} ms", run.name,
+                       run.mb_per_second(), ns_to_ms((double) frame.median.value_or(0)), ns_to_ms(frame.p99));
+            // against the same streams encoding alone, one frame each at a time
+            const auto single = std::find_if(sweep.scaling.begin(), sweep.scaling.end(),
+                                             [&](const auto &scaling) { return scaling.codec == run.name; });
+            if (single != sweep.scaling.end()) {
+                const auto at = std::find(single->threads.begin(), single->threads.end(), run.threads);
+                if (at != single->threads.end()) {
+                    const double alone = mb_per_second(sweep.frame_bytes,
+                                                       median_ns(single->encodes[at - single->threads.begin()]));
+                    fmt::print(" | {:.2f} of {} x single stream", run.mb_per_second() / (alone * run.streams),
+                               run.streams);
+                }
+            }
+            fmt::print("\n");
+        }
+    }
+
+} // end of namespace exrprofile
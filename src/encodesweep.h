@@ -0,0 +1,70 @@
+//
+// Created by symek on 7/26/25.
+//
+#pragma once
+#include <string>
+#include <vector>
+#include "autotune.h"
+#include "encode.h"
+#include "stats.h"
+#include "timing.h"
+#include "verify.h"
+
+namespace exrprofile {
+
+    // One codec on one frame, all in memory: for a tool that wants to pick a codec for the frame it is
+    // about to write, without a process per frame.
+    struct CodecTrial {
+        CodecSetting codec;
+        uint64_t bytes = 0;         // encoded size
+        Samples encodes;            // every repetition (ns)
+        Samples decodes;            // every repetition (ns)
+        ImageError error;           // empty without a verify pool
+    };
+    // Encodes and decodes `source` harness.repetitions times with `threads` each. With a pool the
+    // decoded pixels are compared to the source as well.
+    CodecTrial try_codec(const SourceImage &source, const CodecSetting &codec, int threads, const Harness &harness,
+                         ThreadPool *verify_pool = nullptr);
+
+    struct EncodeSweepOptions {
+        std::vector<int> threads;   // threads per encode of the scaling runs, empty: 1, 2, 4 .. cores
+        int streams = 0;            // encoders side by side in the concurrent runs, 0: one per core
+        int frames = 0;             // frames of a concurrent run, 0: two per stream
+    };
+
+    // Encode time of one codec, one frame at a time, against the threads given to OpenEXR.
+    struct EncodeScaling {
+        std::string codec;
+        std::vector<int> threads;
+        std::vector<Samples> encodes;   // per thread count, every repetition (ns)
+        ScalingFit fit;                 // over (threads, MB/s)
+    };
+
+    // Frames encoded concurrently, `streams` encoders with `threads` each taking frames from one list on
+    // a shared scheduler, like a render node with many processes writing at once.
+    struct ConcurrentEncode {
+        std::string name;               // the codec, or "mixed" for all codecs at once
+        int streams = 1;
+        int threads = 1;
+        long wall_ns = 0;
+        uint64_t raw_bytes = 0;         // of all frames encoded without an error
+        Samples frames;                 // encode time of every such frame (ns)
+
+        double mb_per_second() const;   // aggregate, raw pixels in
+    };
+
+    struct EncodeSweep {
+        uint64_t frame_bytes = 0;       // raw bytes of one frame
+        std::vector<EncodeScaling> scaling;
+        std::vector<ConcurrentEncode> concurrent;   // one per codec, then mixed
+    };
+
+    // Scaling runs encode into memory, so they measure the codec. Concurrent runs write where `target`
+    // says (files named after `prefix`, removed afterwards) with `threads` per encode. OpenEXR's global
+    // pool is sized for every run and put back at the end.
+    EncodeSweep encode_sweep(const SourceImage &source, const std::vector<CodecSetting> &codecs, int threads,
+                             EncodeTarget target, const std::string &prefix, const Harness &harness,
+                             const EncodeSweepOptions &options);
+    void print_encode_sweep(const std::string &title, const EncodeSweep &sweep);
+
+} // end of namespace exrprofile
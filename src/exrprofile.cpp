@@ -2,46 +2,23 @@
 #include <CLI/CLI.hpp>
 #include "exrprofile.h"
 #include "mtread.h"
+#include "coreread.h"
+#include "autotune.h"
+#include "isolate.h"
+#include "synthetic.h"
+#include "encode.h"
+#include "playback.h"
+#include "uring.h"
+#include "verify.h"
+#include "scan.h"
+#include "encodesweep.h"
 #include "threadpool.h"
 #include "stats.h"
+#include "timing.h"
+#include "report.h"
 
 namespace exrprofile {
 
-    void print_sorted_stats(const exrprofile::Results & results) {
-        // Convert map to vector of pairs for sorting FIXME: make stats container suitable for sorting
-        std::vector<std::pair<std::string, exrprofile::Stats>> sorted_results(results.begin(), results.end());
-
-        using namespace exrprofile;
-        std::cout << "\nSorted by Compression Time:\n";
-        std::sort(sorted_results.begin(), sorted_results.end(),
-                  [](const auto &a, const auto &b) {
-                      return a.second[Records::compression] < b.second[Records::compression];
-                  });
-        for (const auto &[name, stat]: sorted_results) {
-            fmt::print("{:>25}: {} ms -> size: {:.2f}MB \n", name, stat[Records::compression],
-                       (double) stat[Records::filesize] / (1024 * 1024));
-        }
-
-        std::cout << "\nSorted by Decompression Time:\n";
-        std::sort(sorted_results.begin(), sorted_results.end(),
-                  [](const auto &a, const auto &b) {
-                      return a.second[Records::decompression] < b.second[Records::decompression];
-                  });
-        for (const auto &[name, stat]: sorted_results) {
-            fmt::print("{:>25}: {} ms -> size: {:.2f}MB \n", name, stat[Records::decompression],
-                       (double) stat[Records::filesize] / (1024 * 1024));
-        }
-
-        std::cout << "\nSorted by File Size:\n";
-        std::sort(sorted_results.begin(), sorted_results.end(),
-                  [](const auto &a, const auto &b) { return a.second[Records::filesize] < b.second[Records::filesize]; });
-        for (const auto &[name, stat]: sorted_results) {
-            fmt::print("{:>25}: {:.2f}MB -> {} ms \n", name, (double)
-                                                                     stat[Records::filesize] / (1024 * 1024),
-                       stat[Records::decompression]);
-        }
-    }
-
     std::vector<std::string> parse_file_list(const std::string &list_path) {
         std::ifstream file(list_path);
         std::vector<std::string> filenames;
@@ -69,73 +46,11 @@ namespace exrprofile {
     }
 
 
-    std::vector<Imf::Rgba> generate_synthetic_pixels(const int width, const int height) {
-
-        // ever wonder if RVO is a real thing ;)
-        std::vector<Imf::Rgba> pixels(width * height);
-        std::vector<int> indices(width * height);
-
-
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_real_distribution<float> dist(0.0f, 0.5f);
-        std::normal_distribution<float> noise(0.0f, 0.15f);
-
-        // Fill the indices with sequential numbers (0, 1, 2, ...)
-        std::iota(indices.begin(), indices.end(), 0);
-
-        // Use transform to fill pixel data based on the generated indices
-        std::transform(std::execution::par_unseq, indices.begin(), indices.end(), pixels.begin(),
-                       [&](int index) {
-                           Imf::Rgba pixel;
-                           const float ramp = static_cast<float>(index) / (width * height);
-                           const float r = std::clamp(dist(gen) + noise(gen), 0.0f, 1.0f);
-                           const float g = std::clamp(dist(gen) + noise(gen), 0.0f, 1.0f);
-                           const float b = std::clamp(dist(gen) + noise(gen), 0.0f, 1.0f);
-                           pixel.r = Imath::half(ramp + r);
-                           pixel.g = Imath::half((1.0f - ramp) + g);
-                           pixel.b = Imath::half(b);
-                           pixel.a = Imath::half(1.0f);  // Alpha channel (optional)
-                           return pixel;
-                       });
-
-        return pixels;
-    }
-
-    void
-    save_exr_file(const std::vector<Imf::Rgba> &pixels, const std::string &filename, const int width, const int height,
-                  const Imf::Compression compression, const int threads) {
-        try {
-
-            Imf::RgbaOutputFile file(filename.c_str(),
-                                     width, height,
-                                     Imf::WRITE_RGBA,
-                                     1,
-                                     Imath::V2f{0, 0}, 1,
-                                     Imf::LineOrder::INCREASING_Y,
-                                     compression,
-                                     threads);
-
-            file.setFrameBuffer(pixels.data(), 1, width);
-            file.writePixels(height);
-        } catch (const std::exception &e) {
-            std::cerr << "Error saving EXR file: " << e.what() << std::endl;
-        }
-    }
-
-    void load_exr_file(const std::string &filename) {
-        try {
-            Imf::RgbaInputFile file(filename.c_str());
-            Imath::Box2i dw = file.dataWindow();
-            int width = dw.max.x - dw.min.x + 1;
-            int height = dw.max.y - dw.min.y + 1;
-
-            std::vector<Imf::Rgba> pixels(width * height);
-            file.setFrameBuffer(pixels.data(), 1, width);
-            file.readPixels(dw.min.y, dw.max.y);
-        } catch (const std::exception &e) {
-            std::cerr << "Error loading EXR file: " << e.what() << std::endl;
-        }
+    // "0.123456 seconds (412.3 MB/s in, 98.1 MB/s out)"
+    std::string throughput(const long ns, const uint64_t in_bytes, const uint64_t out_bytes) {
+        const double seconds = std::max(ns_to_seconds(ns), 1e-9);
+        return fmt::format("{:.6f} seconds ({:.1f} MB/s in, {:.1f} MB/s out)", ns_to_seconds(ns),
+                           (double) in_bytes / (1024 * 1024) / seconds, (double) out_bytes / (1024 * 1024) / seconds);
     }
 
 
@@ -163,14 +78,41 @@ int main(int argc, char **argv) {
     bool verbose = false;
     auto prefix = std::string{"./test_"};
     bool mt_read = false;
+    auto read_options = exrprofile::ReadOptions{};
     std::vector<std::string> files;
     auto list = std::string{""};
 
+    bool core_api = false;
+    bool tune = false;
+    auto isolation = exrprofile::Isolation::none;
+    bool compare_isolation = false;
+    auto tune_options = exrprofile::TuneOptions{};
+    auto chunk_csv = std::string{};
+    auto content = exrprofile::Content::noisy;
+    uint64_t seed = 0;
+    auto zip_levels = std::vector<int>{1, 6, 9};
+    auto dwa_levels = std::vector<float>{25.0f, 90.0f, 250.0f};
+    bool memory = false;
+    bool play = false;
+    bool uring = false;
+    auto buffer_options = exrprofile::BufferOptions{};
+    bool fresh_buffers = false;
+    bool perf = false;
+    auto uring_options = exrprofile::UringOptions{};
+    auto playback_options = exrprofile::PlaybackOptions{};
+    bool fsync = false;
+    bool skip_verify = false;
+    bool scan = false;
+    bool sweep_encodes = false;
+    auto sweep_options = exrprofile::EncodeSweepOptions{};
+    auto scan_options = exrprofile::ScanOptions{};
+    auto harness = exrprofile::Harness{};
+    auto report = exrprofile::ReportOptions{};
+
     // Basic timing tools
-    using clock = std::chrono::high_resolution_clock;
+    using clock = exrprofile::Clock;
     auto timeit = [](auto &&start) {
-        const auto end = clock::now();
-        return std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+        return exrprofile::elapsed_ns(start);
     };
 
     app.add_option("-p,--prefix", prefix, "Prefix to the EXR files (default ./test_ )");
@@ -178,9 +120,133 @@ int main(int argc, char **argv) {
     app.add_option("-w,--workers", workers, "Number of thread workers (x threads) (default 1)");
     app.add_option("-s,--scale", scale, "Multiply of 1Kx1K test size (default 1)");
     app.add_flag("-c,--clean", cleanup, "Cleanup the files");
+    app.add_option("--content", content,
+                   "Test image content: flat, gradient, noisy (render, default), texture, alpha (sparse) or depth")
+            ->transform(CLI::CheckedTransformer(std::map<std::string, exrprofile::Content>{
+                    {"flat",     exrprofile::Content::flat},
+                    {"gradient", exrprofile::Content::gradient},
+                    {"noisy",    exrprofile::Content::noisy},
+                    {"texture",  exrprofile::Content::texture},
+                    {"alpha",    exrprofile::Content::alpha},
+                    {"depth",    exrprofile::Content::depth}}, CLI::ignore_case));
+    app.add_option("--seed", seed, "Seed of the test image, same seed same pixels (default 0)");
+    app.add_option("--zip-levels", zip_levels, "ZIP/ZIPS levels swept as extra entries (default 1,6,9)")
+            ->delimiter(',');
+    app.add_option("--dwa-levels", dwa_levels, "DWAA/DWAB levels swept as extra entries (default 25,90,250)")
+            ->delimiter(',');
+    auto memory_flag = app.add_flag("--memory", memory,
+                                    "Encode into and decode from memory buffers, no filesystem in the timings");
+    app.add_flag("--fsync", fsync, "Include fsync of every written file in the compression time")
+            ->excludes(memory_flag);
+    app.add_flag("--no-verify", skip_verify,
+                 "Don't decode the written files once more to compare their pixels with the source");
+    app.add_flag("--encode-sweep", sweep_encodes,
+                 "Also measure encode MB/s against threads per codec, and codecs encoding side by side");
+    app.add_option("--encode-threads", sweep_options.threads,
+                   "Threads per encode to try with --encode-sweep (default powers of two up to the core count)")
+            ->delimiter(',');
+    app.add_option("--encode-streams", sweep_options.streams,
+                   "Concurrent encoders with --encode-sweep, -t threads each (default one per core)");
+    app.add_option("--encode-frames", sweep_options.frames,
+                   "Frames of every concurrent --encode-sweep run (default two per stream)");
     app.add_flag("-v,--verbose", verbose, "Be more verbose");
     app.add_flag("-r,--read", mt_read, "Profile multi-thread reading");
-    app.add_option("-f,--files", files, "Files to use for multi-thread reading")->expected(-1);
+    app.add_option("--warmup", harness.warmup, "Unmeasured runs before measuring (default 0)");
+    app.add_option("-n,--repeat", harness.repetitions, "Measured runs of every step (default 1)");
+    app.add_flag("--shared", read_options.shared_file,
+                 "Open each frame once and share it between region readers (with -r)");
+    app.add_option("--io", read_options.io,
+                   "Read stream backend: stdio, mmap or pread (default stdio). From OpenEXR 3.3 mmap is copied "
+                   "out of instead of zero-copy, and pread is read concurrently")
+            ->transform(CLI::CheckedTransformer(std::map<std::string, exrprofile::StreamBackend>{
+                    {"stdio", exrprofile::StreamBackend::stdio},
+                    {"mmap",  exrprofile::StreamBackend::mmap},
+                    {"pread", exrprofile::StreamBackend::pread}}, CLI::ignore_case));
+    app.add_option("--cache", read_options.cache,
+                   "Stage frames in memory before decoding (with -r), reporting fetch and decode separately: "
+                   "warm, cold (evict from page cache first) or direct (O_DIRECT)")
+            ->transform(CLI::CheckedTransformer(std::map<std::string, exrprofile::CacheMode>{
+                    {"none",   exrprofile::CacheMode::none},
+                    {"warm",   exrprofile::CacheMode::warm},
+                    {"cold",   exrprofile::CacheMode::cold},
+                    {"direct", exrprofile::CacheMode::direct}}, CLI::ignore_case));
+    app.add_option("--partition", read_options.partition,
+                   "How frames are split between threads (with -r): stripes, aligned (to compression chunks, default) "
+                   "or dynamic (threads take one chunk at a time)")
+            ->transform(CLI::CheckedTransformer(std::map<std::string, exrprofile::Partition>{
+                    {"stripes", exrprofile::Partition::stripes},
+                    {"aligned", exrprofile::Partition::aligned},
+                    {"dynamic", exrprofile::Partition::dynamic}}, CLI::ignore_case));
+    app.add_option("--progress", read_options.progress,
+                   "Print frames done and frames/s of a pass every N seconds (with -r, not with --isolation process)");
+    app.add_flag("--parts", read_options.part_reader,
+                 "Read every file through the tiled/multipart reader (with -r, tiled and multipart files always are)");
+    app.add_option("--channels", read_options.channels,
+                   "Only read these channels, e.g. R,G,B,Z (generic InputFile read instead of RGBA)")
+            ->delimiter(',');
+    app.add_option("--type", read_options.pixel_type,
+                   "Pixel type to decode into: half, float or uint (generic InputFile read instead of RGBA)")
+            ->transform(CLI::CheckedTransformer(std::map<std::string, Imf::PixelType>{
+                    {"half",  Imf::HALF},
+                    {"float", Imf::FLOAT},
+                    {"uint",  Imf::UINT}}, CLI::ignore_case));
+    app.add_option("--level", read_options.level, "Only read this mip/rip level of tiled files (default all)");
+    app.add_option("--window", read_options.window,
+                   "Only read a random window of N x N tiles per level of tiled files (default whole level)");
+    auto core_flag = app.add_flag("--core", core_api, "Decode through the OpenEXR Core API, timing read, decompress "
+                                                      "and unpack of every chunk (with -r)");
+    app.add_option("--chunk-csv", chunk_csv, "Write every chunk timing of --core as CSV");
+    app.add_option("--isolation", isolation,
+                   "How frame workers share OpenEXR's thread pool (with -r): none (every frame resizes the global "
+                   "pool, default), file (pool sized once, numThreads per file) or process (forked workers with "
+                   "private pools)")
+            ->transform(CLI::CheckedTransformer(std::map<std::string, exrprofile::Isolation>{
+                    {"none",    exrprofile::Isolation::none},
+                    {"file",    exrprofile::Isolation::file},
+                    {"process", exrprofile::Isolation::process}}, CLI::ignore_case));
+    app.add_flag("--compare-isolation", compare_isolation,
+                 "Run the files in every isolation mode and compare them to the shared global pool (with -r)");
+    app.add_flag("--autotune", tune,
+                 "Sweep threads x workers and OpenEXR's global vs per file thread count over the files, "
+                 "report the best frames/s and p99 configurations");
+    app.add_option("--tune-threads", tune_options.threads, "Threads per frame to try, e.g. 1,2,4,8 (default powers "
+                                                           "of two up to the core count)")->delimiter(',');
+    app.add_option("--tune-workers", tune_options.workers, "Frame workers to try (default as --tune-threads)")
+            ->delimiter(',');
+    app.add_option("--flat", tune_options.flat,
+                   "Stop sweeping a direction once a step gains less throughput than this (default 0.03 = 3%)");
+    app.add_flag("--fresh-buffers", fresh_buffers,
+                 "Allocate and zero fill every pixel buffer, instead of recycling them from the buffer pool");
+    app.add_flag("--huge-pages", buffer_options.huge_pages, "Back pixel buffers with transparent huge pages");
+    app.add_flag("--perf", perf, "Count cycles, instructions, LLC and branch misses and context switches per phase "
+                                 "and thread (perf_event_open, Linux). With -r, 'pass' counts all threads of the "
+                                 "process (use --warmup so OpenEXR's exist), 'region-caller' only the threads "
+                                 "calling into OpenEXR");
+    app.add_flag("--uring", uring, "Fetch frames with batched io_uring reads, decode them on -w "
+                                                     "workers while the next ones are read (needs liburing)")
+            ->excludes(core_flag);
+    app.add_option("--uring-depth", uring_options.queue_depth, "Reads in flight with --uring (default 32)");
+    app.add_option("--uring-block", uring_options.block_kb, "Size of one --uring read in KB (default 1024)");
+    app.add_option("--uring-ahead", uring_options.frames_ahead,
+                   "Frames fetched ahead of decoding with --uring (default 2 per worker)");
+    app.add_flag("--playback", play, "Play the files in order at --fps through a read-ahead queue, per codec and "
+                                     "resolution, and find the queue depth that plays without drops");
+    app.add_option("--fps", playback_options.fps, "Playback frame rate (default 24)");
+    app.add_option("--depths", playback_options.depths, "Read-ahead depths to try, in frames (default 1,2,4,8,16)")
+            ->delimiter(',');
+    app.add_flag("--scan", scan, "Inventory of -l/-f files (directories and glob patterns too) from their headers and "
+                                 "chunk offset tables only, per codec and sequence, with predicted read costs");
+    app.add_option("--scan-jobs", scan_options.jobs, "Headers read in parallel with --scan (default 4 per core)");
+    app.add_option("--scan-sample", scan_options.sample,
+                   "Files per codec decoded to calibrate predicted read costs with --scan (default 2, 0 none)");
+    app.add_option("--scan-csv", scan_options.csv, "Write every scanned file as CSV");
+    app.add_option("--json", report.json, "Write all results and samples as JSON");
+    app.add_option("--csv", report.csv, "Write all samples as CSV");
+    app.add_option("--compare", report.baseline, "Compare against a baseline JSON, exit code 2 on regressions");
+    app.add_option("--threshold", report.threshold, "Smallest slowdown counted as a regression (default 0.05 = 5%)");
+    app.add_option("--alpha", report.alpha, "Significance level of the regression test (default 0.01)");
+    app.add_option("-f,--files", files, "Files to read (-r), or to re-encode instead of a generated image")
+            ->expected(-1);
     app.add_option("-l,--list", list, "Text file with test EXRs to proceed with (alternatively to -f)");
 
     try {
@@ -189,48 +255,219 @@ int main(int argc, char **argv) {
         return app.exit(e);
     }
 
+    // The scan streams -l itself, a list may be longer than we want to hold twice
+    if (scan) {
+        auto scans = exrprofile::scan_files(list, files, scan_options);
+        exrprofile::ThreadPool pool(threads);
+        exrprofile::predict_read_cost(scans, scan_options, [&](const std::string &filename) {
+            return exrprofile::read_frame(filename, threads, pool, read_options);
+        });
+        exrprofile::print_scan_report(scans, playback_options.fps, threads);
+        if (!scan_options.csv.empty()) {
+            try {
+                exrprofile::write_scan_csv(scan_options.csv, scans);
+                fmt::print("=== Inventory written to {}\n", scan_options.csv);
+            } catch (const std::exception &e) {
+                std::cerr << "Error writing inventory: " << e.what() << std::endl;
+                return 1;
+            }
+        }
+        return 0; // NOTE: We quit here
+    }
+
     if (list != "") {
         files = exrprofile::parse_file_list(list);
         if (files.size() == 0)
             return 1;
     }
 
+    if (perf)
+        perf = exrprofile::enable_perf();
+    auto perf_log = exrprofile::PerfLog{};
+    buffer_options.recycle = !fresh_buffers;
+    exrprofile::buffer_pool().configure(buffer_options);
+
+    // Configuration recorded next to exported results
+    const auto encode_target = memory ? exrprofile::EncodeTarget::memory
+                                      : fsync ? exrprofile::EncodeTarget::fsync : exrprofile::EncodeTarget::disk;
+    mt_read = mt_read || play;
+    auto run = exrprofile::RunInfo{tune ? "autotune" : play ? "playback" : mt_read ? "read" : "compression"};
+    run.config = {{"threads", threads}, {"workers", workers}, {"scale", scale},
+                  {"content", exrprofile::content_name(content)}, {"seed", seed},
+                  {"zip_levels", zip_levels}, {"dwa_levels", dwa_levels}, {"sources", files.size()},
+                  {"encode_target", exrprofile::encode_target_name(encode_target)},
+                  {"verify", !skip_verify}, {"encode_sweep", sweep_encodes},
+                  {"encode_threads", sweep_options.threads}, {"encode_streams", sweep_options.streams},
+                  {"warmup", harness.warmup}, {"repetitions", harness.repetitions},
+                  {"io", exrprofile::backend_name(read_options.io)},
+                  {"cache", exrprofile::cache_mode_name(read_options.cache)},
+                  {"partition", exrprofile::partition_name(read_options.partition)},
+                  {"shared", read_options.shared_file},
+                  {"core", core_api}, {"uring", uring}, {"uring_depth", uring_options.queue_depth},
+                  {"uring_block_kb", uring_options.block_kb},
+                  {"buffers", fresh_buffers ? "fresh" : "pooled"}, {"perf", perf}, {"huge_pages", buffer_options.huge_pages},
+                  {"fps", playback_options.fps}, {"depths", playback_options.depths},
+                  {"isolation", compare_isolation ? "compare" : exrprofile::isolation_name(isolation)},
+                  {"channels", read_options.channels},
+                  {"type", read_options.pixel_type == Imf::HALF ? "half" : read_options.pixel_type == Imf::FLOAT
+                                                                          ? "float" : read_options.pixel_type == Imf::UINT
+                                                                                      ? "uint" : "file"}};
+
+
+    if (tune) {
+        fmt::print("=== Autotuning threads x workers over {} files ({} warmup, {} measured passes each)\n",
+                   files.size(), harness.warmup, std::max(harness.repetitions, 1));
+        const auto points = exrprofile::autotune(files, read_options, harness, tune_options);
+        exrprofile::print_tune_report(points);
+
+        // every configuration is an entry, its frame times the samples
+        auto results = exrprofile::Results{};
+        auto samples = exrprofile::SampleLog{};
+        for (const auto &point: points) {
+            samples[point.name()][exrprofile::Records::decompression] = point.frames;
+            results[point.name()][exrprofile::Records::decompression] = exrprofile::median_of(point.frames);
+        }
+        return exrprofile::report_results(results, samples, run, report); // NOTE: We quit here
+    }
 
     if (mt_read) {
         fmt::print("=== Profiling read from a file with {} threads per frame, and {} worker frames \n", threads,
                    workers);
         auto results = exrprofile::Results{};
-        std::vector<std::thread> frame_threads;
+        auto samples = exrprofile::SampleLog{};
+        // Which records get a sample per repetition
+        constexpr std::array timed_records = {exrprofile::Records::decompression, exrprofile::Records::setup,
+                                              exrprofile::Records::fetch, exrprofile::Records::decode,
+                                              exrprofile::Records::alloc};
 
         for (const auto &filename: files) {
             const std::uintmax_t filesize = std::filesystem::file_size(filename);
             results[filename] = {0, 0, (long) filesize};
+            samples[filename] = {};
         }
 
-        std::atomic<size_t> frame_index{0};
-        auto frame_worker = [&, threads]() {
-            exrprofile::ThreadPool pool(threads);
-            while (true) {
-                using namespace exrprofile;
-                const size_t frame = frame_index.fetch_add(1);
-                if (frame >= files.size()) break;
-                const auto &filename = files[frame];
-                const auto result = multithreaded_read(filename, threads, pool);
-                results[filename][Records::decompression] = result;
-            }
+        // One scheduler for the regions of all frames. Size it for workers x threads, but
+        // don't go past the number of cores, the pool balances the frames itself.
+        const size_t hardware = std::max(std::thread::hardware_concurrency(), 1u);
+        exrprofile::ThreadPool pool(std::min<size_t>((size_t) workers * threads, hardware));
+        fmt::print("=== Scheduler: {} threads\n", pool.size());
+
+        auto core_profile = exrprofile::CoreProfile{};
+        core_profile.keep_chunks = !chunk_csv.empty();
+
+        // Core profiles of forked workers stay in their processes
+        bool measured = false;
+        const exrprofile::PoolReader reader = [&](const std::string &filename, exrprofile::ThreadPool &frame_pool,
+                                                  const exrprofile::ReadOptions &options) {
+            const bool profiled = measured && isolation != exrprofile::Isolation::process;
+            return core_api ? exrprofile::core_read(filename, threads, frame_pool, options,
+                                                    profiled ? &core_profile : nullptr)
+                            : exrprofile::read_frame(filename, threads, frame_pool, options);
         };
 
+        if (play) {
+            // Entries are sequence and depth, samples the decode times of the frames it decoded
+            auto quiet_options = read_options;
+            quiet_options.quiet = true;
+            const auto reports = exrprofile::playback(files, threads, workers, pool, quiet_options, reader,
+                                                      playback_options);
+            exrprofile::print_playback_report(reports, playback_options.fps);
+            auto play_results = exrprofile::Results{};
+            auto play_samples = exrprofile::SampleLog{};
+            for (const auto &played: reports) {
+                for (const auto &play_run: played.runs) {
+                    const auto name = fmt::format("playback:{}:d{}", played.sequence.name, play_run.depth);
+                    play_samples[name][exrprofile::Records::decompression] = play_run.frames;
+                    play_results[name][exrprofile::Records::decompression] = exrprofile::median_of(play_run.frames);
+                }
+            }
+            return exrprofile::report_results(play_results, play_samples, run, report); // NOTE: We quit here
+        }
 
-        const auto start_reading = clock::now();
-        for (int i = 0; i < workers; ++i) {
-            frame_threads.emplace_back(frame_worker);
+        if (compare_isolation) {
+            // Same passes in every mode, entries are the modes
+            auto quiet_options = read_options;
+            quiet_options.quiet = true;
+            auto runs = std::vector<exrprofile::IsolationRun>{};
+            auto mode_results = exrprofile::Results{};
+            auto mode_samples = exrprofile::SampleLog{};
+            for (const auto mode: {exrprofile::Isolation::none, exrprofile::Isolation::file,
+                                   exrprofile::Isolation::process}) {
+                auto &run_of_mode = runs.emplace_back();
+                run_of_mode.isolation = mode;
+                for (int pass = 0; pass < harness.warmup + std::max(harness.repetitions, 1); ++pass) {
+                    const auto result = exrprofile::isolated_pass(files, threads, workers, pool, quiet_options, mode, reader);
+                    if (pass < harness.warmup)
+                        continue;
+                    run_of_mode.passes.push_back(result.wall_ns);
+                    for (const auto &frame: result.frames)
+                        run_of_mode.frames.push_back(frame[exrprofile::Records::decompression]);
+                }
+                const auto name = std::string{"isolation:"} + exrprofile::isolation_name(mode);
+                mode_samples[name][exrprofile::Records::decompression] = run_of_mode.frames;
+                mode_results[name][exrprofile::Records::decompression] = exrprofile::median_of(run_of_mode.frames);
+            }
+            exrprofile::print_isolation_report(runs, files.size());
+            return exrprofile::report_results(mode_results, mode_samples, run, report); // NOTE: We quit here
         }
 
-        for (auto &t: frame_threads) {
-            t.join();
+        // --uring: frames arrive fetched and are decoded concurrently, so every file gets its own threads
+        if (uring && !exrprofile::uring_available()) {
+            std::cerr << "io_uring is not available (built without liburing, or refused by the kernel)." << std::endl;
+            return 1;
+        }
+        auto uring_stats = exrprofile::UringStats{};
+        auto uring_read_options = read_options;
+        uring_read_options.file_threads = threads;
+        const exrprofile::StagedReader staged_reader = [&](const std::string &filename,
+                                                           const exrprofile::StagedFile &staged) {
+            auto options = uring_read_options;
+            options.prefetched = &staged;
+            return exrprofile::read_frame(filename, threads, pool, options);
+        };
+        if (uring)
+            Imf::setGlobalThreadCount(threads * workers);
+
+        // Every pass reads the whole list, warmup passes are not recorded.
+        auto pass_times = exrprofile::Samples{};
+        for (int pass = 0; pass < harness.warmup + std::max(harness.repetitions, 1); ++pass) {
+            measured = pass >= harness.warmup;
+            auto result = exrprofile::PassResult{};
+            // Decoding runs on OpenEXR's threads, the region scopes only see the threads waiting on them
+            std::optional<exrprofile::ProcessPerfScope> counters;
+            if (measured)
+                counters.emplace("pass");
+            if (uring) {
+                auto fetched = exrprofile::uring_pass(files, workers, uring_read_options, uring_options, staged_reader);
+                if (measured)
+                    uring_stats.merge(fetched.stats);
+                result = std::move(fetched.pass);
+            } else {
+                result = exrprofile::isolated_pass(files, threads, workers, pool, read_options, isolation, reader);
+            }
+            counters.reset();
+            if (!measured) {
+                exrprofile::take_perf();   // counters of warmup passes go too
+                continue;
+            }
+            pass_times.push_back(result.wall_ns);
+            for (size_t i = 0; i < files.size(); ++i) {
+                auto &file_samples = samples[files[i]];
+                for (const auto record: timed_records)
+                    file_samples[record].push_back(result.frames[i][record]);
+                // Same plan every pass, a count per pass (a failed read reports none)
+                auto &redundant = results[files[i]][exrprofile::Records::redundant];
+                redundant = std::max(redundant, result.frames[i][exrprofile::Records::redundant]);
+            }
         }
+        const auto read_time = exrprofile::median_of(pass_times);
+        // Whole passes and region reads of all files, per thread
+        const auto read_phases = exrprofile::take_perf();
+        exrprofile::add_perf(perf_log, "read", read_phases);
 
-        const auto read_time = timeit(start_reading);
+        for (auto &[filename, stat]: results)
+            for (const auto record: timed_records)
+                stat[record] = exrprofile::median_of(samples[filename][record]);
 
 
         if (verbose) {
@@ -242,74 +479,251 @@ int main(int argc, char **argv) {
                           return a.second[Records::decompression] < b.second[Records::decompression];
                       });
             for (const auto &[name, stat]: sorted_results) {
-                fmt::print("{:>25}: {} ms -> size: {:.2f}MB \n", name, stat[Records::decompression],
+                fmt::print("{:>25}: {:.3f} ms (setup {:.3f} ms, fetch {:.3f} ms, decode {:.3f} ms) -> size: {:.2f}MB \n",
+                           name, ns_to_ms(stat[Records::decompression]), ns_to_ms(stat[Records::setup]),
+                           ns_to_ms(stat[Records::fetch]), ns_to_ms(stat[Records::decode]),
                            (double) stat[Records::filesize] / (1024 * 1024));
             }
+            if (harness.repetitions > 1)
+                print_sample_stats(samples, Records::decompression, "Reading time");
         }
 
         auto readings = std::vector<long>();
-        for (const auto &[read, stat]: results) {
-            readings.push_back(stat[exrprofile::Records::decompression]);
+        auto setups = std::vector<long>();
+        auto fetches = std::vector<long>();
+        auto decodes = std::vector<long>();
+        auto allocs = std::vector<long>();
+        long redundant_chunks = 0;
+        for (const auto &[read, stat]: results)
+            redundant_chunks += stat[exrprofile::Records::redundant];
+        // Summaries go over every frame of every repetition, that's where the tail is.
+        for (const auto &[read, records]: samples) {
+            using exrprofile::Records;
+            readings.insert(readings.end(), records[Records::decompression].begin(), records[Records::decompression].end());
+            setups.insert(setups.end(), records[Records::setup].begin(), records[Records::setup].end());
+            fetches.insert(fetches.end(), records[Records::fetch].begin(), records[Records::fetch].end());
+            decodes.insert(decodes.end(), records[Records::decode].begin(), records[Records::decode].end());
+            allocs.insert(allocs.end(), records[Records::alloc].begin(), records[Records::alloc].end());
         }
 
         std::cout << exrprofile::StatsSummary<long>::compute(readings, true);
-        fmt::print("Total time: {:.6f} seconds (avg. {} ms per frame)\n",
-                   (double) read_time / 1024, read_time / files.size());
-        return 0; // NOTE: We quit here
+        std::cout << "Setup: " << exrprofile::StatsSummary<long>::compute(setups, true);
+        std::cout << "Alloc: " << exrprofile::StatsSummary<long>::compute(allocs, true);
+        exrprofile::print_buffer_counters(exrprofile::buffer_pool().counters(), buffer_options);
+        fmt::print("Redundant chunks decoded: {}\n", redundant_chunks);
+        if (read_options.cache != exrprofile::CacheMode::none) {
+            const auto fetch_stats = exrprofile::StatsSummary<long>::compute(fetches, true);
+            const auto decode_stats = exrprofile::StatsSummary<long>::compute(decodes, true);
+            std::cout << "Fetch: " << fetch_stats;
+            std::cout << "Decode: " << decode_stats;
+            fmt::print("=== {} cache: {} ({:.1f}% of frame time is fetch)\n",
+                       exrprofile::cache_mode_name(read_options.cache),
+                       fetch_stats.mean > decode_stats.mean ? "I/O-bound" : "CPU-bound",
+                       100.0 * fetch_stats.mean / std::max(fetch_stats.mean + decode_stats.mean, 1e-9));
+        }
+        if (uring) {
+            std::cout << "Fetch: " << exrprofile::StatsSummary<long>::compute(fetches, true);
+            exrprofile::print_uring_stats(uring_stats, uring_options);
+        }
+        if (core_api) {
+            exrprofile::print_core_profile(core_profile);
+            if (!chunk_csv.empty()) {
+                try {
+                    exrprofile::write_chunk_csv(chunk_csv, core_profile);
+                    fmt::print("=== Chunks written to {}\n", chunk_csv);
+                } catch (const std::exception &e) {
+                    std::cerr << "Error writing chunks: " << e.what() << std::endl;
+                }
+            }
+        }
+        if (perf) {
+            exrprofile::print_perf_log(perf_log);
+            exrprofile::print_perf_threads(read_phases);
+        }
+        fmt::print("Total time: {:.6f} seconds (avg. {:.3f} ms per frame, median of {} passes)\n",
+                   exrprofile::ns_to_seconds(read_time),
+                   exrprofile::ns_to_ms((double) read_time / std::max<size_t>(files.size(), 1)), pass_times.size());
+        return exrprofile::report_results(results, samples, run, report, perf_log); // NOTE: We quit here
     }
 
     const int width = std::clamp(scale, 1, 32) * 1024;
     const int height = width;
 
-    // Generate random channel data
-    fmt::print("=== Generating random data: {}x{} with {} ===\n", width, height, threads);
-
-    auto compression_list = std::vector<int>(Imf::Compression::NUM_COMPRESSION_METHODS);
-    std::iota(compression_list.begin(), compression_list.end(), 0);
-    auto compression_name = std::string{};
-
+    // Sources: files from -f/-l in their own channels, types and windows, or one generated RGBA frame.
+    const bool real_sources = !files.empty();
+    const auto sources = real_sources ? files : std::vector<std::string>{""};
+    const auto codecs = exrprofile::codec_sweep(zip_levels, dwa_levels);
+    // Real files are decoded the way they are stored, all channels in their own types
+    auto decode_options = read_options;
+    decode_options.native = real_sources;
 
     auto results = exrprofile::Results{};
-    const auto start_gen = clock::now();
-    const std::vector<Imf::Rgba> pixels = exrprofile::generate_synthetic_pixels(width, height);
-    const auto end_gen = timeit(start_gen);
-    fmt::print("{:>15}: {:.6f} seconds\n", "making pixels", (double) end_gen / 1024);
-
-    std::cout << "=== Profiling compressions" << " ===" << std::endl;
-    for (const auto compression: compression_list) {
-
-        getCompressionNameFromId(static_cast<Imf::Compression>(compression), compression_name);
-        const auto filename = prefix + compression_name + std::string{".exr"};
-        auto compression_description = std::string{};
-        getCompressionDescriptionFromId(static_cast<Imf::Compression>(compression), compression_description);
-
-        // Measure compression time
-        const auto start_compress = clock::now();
-        exrprofile::save_exr_file(pixels, filename, width, height, static_cast<Imf::Compression>(compression), threads);
-        const auto compression_time = timeit(start_compress);
-
-        const std::uintmax_t filesize = std::filesystem::file_size(filename);
-        fmt::print("{} -> {}\n", filename, compression_description);
-        fmt::print("{:>15}: {:.6f} seconds\n", "compression", (double) compression_time / 1024);
-
-        // Measure decompression time
-        const auto start_decompress = clock::now();
-        exrprofile::load_exr_file(filename);
-        const auto decompression_time = timeit(start_decompress);
-        fmt::print("{:>15}: {:.6f} seconds\n", "decompression", (double) decompression_time / 1024);
-
-        // Store stats
-        results[compression_name] = {(long) compression_time, (long) decompression_time, (long) filesize};
+    auto samples = exrprofile::SampleLog{};
+    auto totals = std::map<std::string, exrprofile::CodecTotals>{};
+    auto synthetic = std::vector<Imf::Rgba>{};
+    // --memory: every codec encodes into (and decodes from) the same buffer
+    auto encoded = exrprofile::MemoryOStream{};
+    exrprofile::ThreadPool verify_pool(std::max(std::thread::hardware_concurrency(), 1u));
+
+    for (const auto &source_file: sources) {
+        auto source = exrprofile::SourceImage{};
+        auto stem = std::string{};
+        if (real_sources) {
+            try {
+                source = exrprofile::load_source(source_file);
+            } catch (const std::exception &e) {
+                std::cerr << "Error loading source: " << e.what() << std::endl;
+                continue;
+            }
+            stem = std::filesystem::path(source_file).stem().string();
+            fmt::print("=== Source: {} ({} channels, {:.2f}MB raw) ===\n", source_file, source.layout.channels.size(),
+                       (double) source.raw_bytes() / (1024 * 1024));
+        } else {
+            fmt::print("=== Generating {} data: {}x{}, seed {} ===\n", exrprofile::content_name(content), width,
+                       height, seed);
+            exrprofile::ThreadPool generator_pool(std::max(std::thread::hardware_concurrency(), 1u));
+            long end_gen = 0;
+            {
+                exrprofile::ProcessPerfScope counters("generate");
+                const auto start_gen = clock::now();
+                synthetic = exrprofile::generate_synthetic_pixels(width, height, content, seed, generator_pool);
+                end_gen = timeit(start_gen);
+            }
+            exrprofile::add_perf(perf_log, "synthetic", exrprofile::take_perf());
+            fmt::print("{:>15}: {:.6f} seconds\n", "making pixels", exrprofile::ns_to_seconds(end_gen));
+            source = exrprofile::rgba_source("synthetic", synthetic, width, height);
+        }
 
-        // Optionally cleanup our mess
-        if (cleanup)
-            exrprofile::delete_test_file(filename);
+        fmt::print("=== Profiling compressions ({}) ===\n", exrprofile::encode_target_name(encode_target));
+        auto rate_points = std::vector<exrprofile::RatePoint>{};
+        for (const auto &codec: codecs) {
+            // entries of real sources are "stem/CODEC[:level]"
+            const auto name = real_sources ? stem + "/" + codec.name() : codec.name();
+            const auto filename = prefix + (real_sources ? stem + "_" : "") + codec.file_tag() + std::string{".exr"};
+            auto compression_description = std::string{};
+            getCompressionDescriptionFromId(codec.compression, compression_description);
+
+            try {
+                // Measure compression time. Counters open around all repetitions (warmup included),
+                // opening them per thread inside would land in the timings.
+                auto entry = std::array<exrprofile::Samples, exrprofile::Records::num_records>{};
+                {
+                    exrprofile::ProcessPerfScope counters("compress");
+                    entry[exrprofile::Records::compression] = exrprofile::measure(harness, [&]() {
+                        if (encode_target == exrprofile::EncodeTarget::memory) {
+                            encoded.clear();
+                            exrprofile::save_image(source, encoded, codec, threads);
+                            return;
+                        }
+                        exrprofile::save_image(source, filename, codec, threads);
+                        if (encode_target == exrprofile::EncodeTarget::fsync)
+                            exrprofile::sync_file(filename);
+                    });
+                }
+                const auto compression_time = exrprofile::median_of(entry[exrprofile::Records::compression]);
+
+                const std::uintmax_t filesize = encode_target == exrprofile::EncodeTarget::memory
+                                                ? encoded.size() : std::filesystem::file_size(filename);
+                fmt::print("{} -> {}\n", encode_target == exrprofile::EncodeTarget::memory ? name : filename,
+                           compression_description);
+                fmt::print("{:>15}: {}\n", "compression",
+                           exrprofile::throughput(compression_time, source.raw_bytes(), filesize));
+
+                // Measure decompression time
+                {
+                    exrprofile::ProcessPerfScope counters("decompress");
+                    entry[exrprofile::Records::decompression] = exrprofile::measure(harness, [&]() {
+                        if (encode_target == exrprofile::EncodeTarget::memory) {
+                            exrprofile::MemoryIStream stream(name, encoded.data(), encoded.size());
+                            exrprofile::load_exr_stream(stream, decode_options);
+                            return;
+                        }
+                        exrprofile::load_exr_file(filename, decode_options);
+                    });
+                }
+                const auto decompression_time = exrprofile::median_of(entry[exrprofile::Records::decompression]);
+                fmt::print("{:>15}: {}\n", "decompression",
+                           exrprofile::throughput(decompression_time, filesize, source.raw_bytes()));
+
+                // Store stats
+                exrprofile::add_perf(perf_log, name, exrprofile::take_perf());
+                samples[name] = entry;
+                results[name] = {compression_time, decompression_time, (long) filesize};
+                auto &total = totals[codec.name()];
+                total.raw_bytes += source.raw_bytes();
+                total.file_bytes += filesize;
+                total.encode_ns += compression_time;
+                total.decode_ns += decompression_time;
+
+                // What came back, decoded once more outside the timings
+                if (!skip_verify) {
+                    try {
+                        auto decoded = exrprofile::BufferPool::Buffer{};
+                        if (encode_target == exrprofile::EncodeTarget::memory) {
+                            exrprofile::MemoryIStream stream(name, encoded.data(), encoded.size());
+                            decoded = exrprofile::decode_pixels(stream, source, threads);
+                        } else {
+                            const auto stream = exrprofile::open_istream(filename, decode_options.io);
+                            decoded = exrprofile::decode_pixels(*stream, source, threads);
+                        }
+                        const auto start_verify = clock::now();
+                        const auto error = exrprofile::compare_pixels(source, decoded.data(), verify_pool);
+                        const auto verify_time = timeit(start_verify);
+                        fmt::print("{:>15}: {:.6f} seconds ({:.2f}x of decompression)\n", "verification",
+                                   exrprofile::ns_to_seconds(verify_time),
+                                   (double) verify_time / (double) std::max(decompression_time, 1L));
+                        exrprofile::print_image_error(error);
+                        rate_points.push_back({name, filesize, compression_time, decompression_time,
+                                               exrprofile::worst_psnr(error), exrprofile::worst_max_abs(error)});
+                    } catch (const std::exception &e) {
+                        std::cerr << "Error verifying " << name << ": " << e.what() << std::endl;
+                    }
+                }
+            } catch (const std::exception &e) {
+                std::cerr << "Error encoding " << name << ": " << e.what() << std::endl;
+            }
 
+            // Optionally cleanup our mess
+            if (cleanup && encode_target != exrprofile::EncodeTarget::memory)
+                exrprofile::delete_test_file(filename);
+        }
+        exrprofile::print_rate_distortion(real_sources ? stem : "synthetic", rate_points);
+
+        if (sweep_encodes) {
+            fmt::print("=== Encode scaling and concurrent encodes ({}) ===\n",
+                       exrprofile::encode_target_name(encode_target));
+            const auto sweep = exrprofile::encode_sweep(source, codecs, threads, encode_target, prefix, harness,
+                                                        sweep_options);
+            exrprofile::print_encode_sweep(real_sources ? stem : "synthetic", sweep);
+            // "encode:ZIP:t4" per thread count, "encode:ZIP:x16" per concurrent run (frame times)
+            const auto entry_prefix = (real_sources ? stem + "/" : std::string{}) + "encode:";
+            for (const auto &scaling: sweep.scaling) {
+                for (size_t i = 0; i < scaling.threads.size(); ++i) {
+                    const auto name = fmt::format("{}{}:t{}", entry_prefix, scaling.codec, scaling.threads[i]);
+                    samples[name][exrprofile::Records::compression] = scaling.encodes[i];
+                    results[name][exrprofile::Records::compression] = exrprofile::median_of(scaling.encodes[i]);
+                }
+            }
+            for (const auto &concurrent: sweep.concurrent) {
+                const auto name = fmt::format("{}{}:x{}", entry_prefix, concurrent.name, concurrent.streams);
+                samples[name][exrprofile::Records::compression] = concurrent.frames;
+                results[name][exrprofile::Records::compression] = exrprofile::median_of(concurrent.frames);
+            }
+        }
     }
 
     exrprofile::print_sorted_stats(results);
+    exrprofile::print_buffer_counters(exrprofile::buffer_pool().counters(), buffer_options);
+    if (perf)
+        exrprofile::print_perf_log(perf_log);
+    if (real_sources)
+        exrprofile::print_codec_totals(totals);
+    if (harness.repetitions > 1) {
+        exrprofile::print_sample_stats(samples, exrprofile::Records::compression, "Compression time");
+        exrprofile::print_sample_stats(samples, exrprofile::Records::decompression, "Decompression time");
+    }
 
-    return 0;
+    return exrprofile::report_results(results, samples, run, report, perf_log);
 }
 
 
@@ -10,10 +10,10 @@
 #include <array>
 #include <iostream>
 #include <vector>
+#include <map>
 #include <chrono>
 #include <random>
 #include <string>
-#include <execution>
 #include <filesystem>
 #include <thread>
 #include <fstream>
@@ -22,12 +22,22 @@
 
 namespace exrprofile {
 
-    using Stats = std::array<long, 3>;
     enum Records {
         compression = 0,
         decompression = 1,
-        filesize = 2
+        filesize = 2,
+        setup = 3,          // time spent opening files / parsing headers and offsets
+        fetch = 4,          // raw bytes from storage into memory (staged reads only)
+        decode = 5,         // decoding from memory (staged reads only)
+        redundant = 6,      // chunks decoded more than once because a region boundary split them (count)
+        alloc = 7,          // allocating and first touching pixel buffers, 0 when the buffer pool recycled them
+        num_records
     };
+    using Stats = std::array<long, Records::num_records>;   // times in nanoseconds, sizes in bytes
+
+    // Every measured repetition (ns), per name and record. Stats hold the median of these.
+    using Samples = std::vector<long>;
+    using SampleLog = std::map<std::string, std::array<Samples, Records::num_records>>;
 
     using Results = std::map<std::string, exrprofile::Stats>;
 
@@ -0,0 +1,73 @@
+//
+// Created by symek on 4/19/25.
+//
+#include "framebuffer.h"
+#include <iostream>
+#include <mutex>
+#include <set>
+
+namespace exrprofile {
+
+    size_t pixel_type_size(const Imf::PixelType type) {
+        switch (type) {
+            case Imf::HALF: return 2;
+            case Imf::UINT:
+            case Imf::FLOAT: return 4;
+            default: return 0;
+        }
+    }
+
+    PixelLayout layout_for(const Imf::ChannelList &channels, const std::vector<std::string> &names,
+                           const Imf::PixelType type, std::vector<std::string> *missing) {
+        PixelLayout layout;
+        auto add = [&](const std::string &name, const Imf::Channel &channel) {
+            if (channel.xSampling != 1 || channel.ySampling != 1)
+                return;
+            const Imf::PixelType target = type == Imf::NUM_PIXELTYPES ? channel.type : type;
+            layout.channels.emplace_back(name, target);
+            layout.pixel_size += pixel_type_size(target);
+        };
+
+        if (names.empty()) {
+            for (auto it = channels.begin(); it != channels.end(); ++it)
+                add(it.name(), it.channel());
+            return layout;
+        }
+        // Keep the requested order. Missing channels would only measure OpenEXR filling in zeros.
+        for (const auto &name: names) {
+            if (const Imf::Channel *channel = channels.findChannel(name))
+                add(name, *channel);
+            else if (missing)
+                missing->push_back(name);
+        }
+        return layout;
+    }
+
+    void warn_missing_channels(const std::vector<std::string> &missing) {
+        if (missing.empty())
+            return;
+        static std::mutex mutex;
+        static std::set<std::string> warned;
+        std::scoped_lock lock(mutex);
+        for (const auto &name: missing)
+            if (warned.insert(name).second)
+                std::cerr << "Channel " << name << " not in file, skipped." << std::endl;
+    }
+
+    Imf::FrameBuffer frame_buffer_for(const PixelLayout &layout, const Imath::Box2i &window, char *storage) {
+        const size_t width = window.max.x - window.min.x + 1;
+        const size_t row_size = width * layout.pixel_size;
+        // OpenEXR addresses pixels by absolute (x, y), so shift the base back to the data window origin.
+        char *origin = storage - static_cast<ptrdiff_t>(window.min.x) * (ptrdiff_t) layout.pixel_size
+                               - static_cast<ptrdiff_t>(window.min.y) * (ptrdiff_t) row_size;
+
+        Imf::FrameBuffer frame_buffer;
+        size_t offset = 0;
+        for (const auto &[name, type]: layout.channels) {
+            frame_buffer.insert(name, Imf::Slice(type, origin + offset, layout.pixel_size, row_size));
+            offset += pixel_type_size(type);
+        }
+        return frame_buffer;
+    }
+
+} // end of namespace exrprofile
@@ -0,0 +1,38 @@
+//
+// Created by symek on 4/19/25.
+//
+#pragma once
+#include <OpenEXR/ImfChannelList.h>
+#include <OpenEXR/ImfFrameBuffer.h>
+#include <OpenEXR/ImfPixelType.h>
+#include <Imath/ImathBox.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace exrprofile {
+
+    size_t pixel_type_size(Imf::PixelType type);
+
+    // Channels of a generic (non-RGBA) read, stored interleaved: one pixel holds all of them back to back.
+    struct PixelLayout {
+        std::vector<std::pair<std::string, Imf::PixelType>> channels;
+        size_t pixel_size = 0;
+    };
+
+    // Full resolution channels of a part: the ones listed in `names` (all if empty), either in their
+    // file pixel types or converted to `type` (NUM_PIXELTYPES keeps the file's). Subsampled channels
+    // (e.g. luminance/chroma) are left out, they need their own buffer geometry. Requested names the
+    // part doesn't have are skipped and added to `missing`.
+    PixelLayout layout_for(const Imf::ChannelList &channels, const std::vector<std::string> &names = {},
+                           Imf::PixelType type = Imf::NUM_PIXELTYPES, std::vector<std::string> *missing = nullptr);
+
+    // Prints a warning for every name not warned about before in this process. Layouts are made per
+    // region, so a channel missing from a whole file list would otherwise warn for every one of them.
+    void warn_missing_channels(const std::vector<std::string> &missing);
+
+    // Frame buffer that puts `window` of the image into `storage`, which must hold
+    // window width * height * layout.pixel_size bytes.
+    Imf::FrameBuffer frame_buffer_for(const PixelLayout &layout, const Imath::Box2i &window, char *storage);
+
+} // end of namespace exrprofile
@@ -0,0 +1,123 @@
+//
+// Created by symek on 5/24/25.
+//
+#include "isolate.h"
+#include "stats.h"
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+namespace exrprofile {
+
+    namespace {
+
+        // What forked workers share with the parent: the next frame to take, then (a cache line further)
+        // one Stats per frame.
+        constexpr size_t frames_offset = 64;
+        static_assert(std::atomic<size_t>::is_always_lock_free, "the frame counter has to work across processes");
+
+        PassResult process_pass(const std::vector<std::string> &files, const int threads, const int workers,
+                                const ReadOptions &options, const PoolReader &reader) {
+            const size_t bytes = frames_offset + sizeof(Stats) * std::max<size_t>(files.size(), 1);
+            void *memory = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED)
+                throw std::runtime_error(std::string("Could not map shared results: ") + std::strerror(errno));
+            auto *next = new(memory) std::atomic<size_t>{0};
+            auto *frames = reinterpret_cast<Stats *>(static_cast<char *>(memory) + frames_offset);   // zeroed
+
+            // Children only get the forking thread, so the parent's OpenEXR pool must not have threads
+            // a child would try to join when it sizes its own. Buffered output would be printed twice.
+            Imf::setGlobalThreadCount(0);
+            std::cout.flush();
+            std::fflush(stdout);
+
+            PassResult pass;
+            const auto start = Clock::now();
+            std::vector<pid_t> children;
+            for (int i = 0; i < std::max(workers, 1); ++i) {
+                const pid_t pid = ::fork();
+                if (pid < 0) {
+                    std::cerr << "Could not fork frame worker: " << std::strerror(errno) << std::endl;
+                    break;
+                }
+                if (pid == 0) {
+                    int status = 0;
+                    try {
+                        Imf::setGlobalThreadCount(threads);
+                        ThreadPool pool(threads);
+                        ReadOptions own = options;
+                        own.file_threads = threads;   // the global pool is ours, nobody resizes it
+                        for (size_t frame = next->fetch_add(1); frame < files.size(); frame = next->fetch_add(1))
+                            frames[frame] = reader(files[frame], pool, own);
+                    } catch (const std::exception &e) {
+                        std::cerr << "Error in frame worker: " << e.what() << std::endl;
+                        status = 1;
+                    }
+                    std::cout.flush();
+                    std::fflush(stdout);
+                    ::_exit(status);
+                }
+                children.push_back(pid);
+            }
+            for (const pid_t pid: children) {
+                int status = 0;
+                if (::waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                    std::cerr << "Frame worker " << pid << " failed, its frames are missing." << std::endl;
+            }
+            pass.wall_ns = elapsed_ns(start);
+
+            pass.frames.assign(frames, frames + files.size());
+            ::munmap(memory, bytes);
+            return pass;
+        }
+    }
+
+    const char *isolation_name(const Isolation isolation) {
+        switch (isolation) {
+            case Isolation::file: return "file";
+            case Isolation::process: return "process";
+            default: return "none";
+        }
+    }
+
+    PassResult isolated_pass(const std::vector<std::string> &files, const int threads, const int workers,
+                             ThreadPool &pool, const ReadOptions &options, const Isolation isolation,
+                             const PoolReader &reader) {
+        if (isolation == Isolation::process)
+            return process_pass(files, threads, workers, options, reader);
+
+        ReadOptions own = options;
+        if (isolation == Isolation::file) {
+            own.file_threads = threads;
+            if (Imf::globalThreadCount() != threads * workers)
+                Imf::setGlobalThreadCount(threads * workers);
+        } else {
+            own.file_threads = 0;
+        }
+        return read_pass(files, workers, [&](const std::string &filename) {
+            return reader(filename, pool, own);
+        }, options.progress);
+    }
+
+    void print_isolation_report(const std::vector<IsolationRun> &runs, const size_t files) {
+        double baseline = 0.0;
+        fmt::print("\nIsolation of frame workers:\n");
+        for (const auto &run: runs) {
+            if (run.passes.empty()) continue;
+            const auto pass = StatsSummary<long>::compute(run.passes, true);
+            const auto frame = StatsSummary<long>::compute(run.frames, true);
+            const double fps = (double) files / std::max(ns_to_seconds((double) deref(pass.median)), 1e-9);
+            if (run.isolation == Isolation::none)
+                baseline = fps;
+            fmt::print("{:>15}: {:.2f} fps | frame mean {:.3f} ms | p99 {:.3f} ms",
+                       isolation_name(run.isolation), fps, ns_to_ms(frame.mean), ns_to_ms(frame.p99));
+            if (baseline > 0.0 && run.isolation != Isolation::none)
+                fmt::print(" | {:+.1f}% fps vs shared global pool", 100.0 * (fps / baseline - 1.0));
+            fmt::print("\n");
+        }
+    }
+
+} // end of namespace exrprofile
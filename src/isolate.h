@@ -0,0 +1,37 @@
+//
+// Created by symek on 5/24/25.
+//
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+#include "mtread.h"
+
+namespace exrprofile {
+
+    // How frame workers share OpenEXR's process wide thread pool
+    enum class Isolation {
+        none,      // every frame sets the global thread count to its threads (workers keep resizing it)
+        file,      // global pool sized once for workers x threads, files get numThreads in their constructors
+        process    // every worker is a forked process with a private global pool of its own
+    };
+    const char *isolation_name(Isolation isolation);
+
+    // Reads one frame with the given pool and options (read_frame, core_read, ...).
+    using PoolReader = std::function<Stats(const std::string &filename, ThreadPool &pool, const ReadOptions &options)>;
+
+    // One pass over the files with `workers` frames in flight, isolated as asked. The pool is used by the
+    // in-process modes; forked workers build their own with `threads` threads, take frames from a
+    // shared memory counter and leave their Stats in a shared memory array. Fork time is part of the pass.
+    PassResult isolated_pass(const std::vector<std::string> &files, int threads, int workers, ThreadPool &pool,
+                             const ReadOptions &options, Isolation isolation, const PoolReader &reader);
+
+    struct IsolationRun {
+        Isolation isolation = Isolation::none;
+        Samples passes;   // wall time per pass (ns)
+        Samples frames;   // frame time (ns) of every frame of every pass
+    };
+    // Frames/s and frame time percentiles of every mode against the shared global pool (none).
+    void print_isolation_report(const std::vector<IsolationRun> &runs, size_t files);
+
+} // end of namespace exrprofile
@@ -0,0 +1,27 @@
+//
+// Created by symek on 8/2/25.
+//
+#pragma once
+// Everything exrprofile measures, for tools linking libexrprofile instead of running the CLI:
+//
+//   reading    read_frame, multithreaded_read, load_exr_file / load_exr_stream (mtread.h),
+//              core_read (coreread.h), read_pass / isolated_pass over file lists (isolate.h)
+//   encoding   load_source, rgba_source, save_image (encode.h), try_codec, encode_sweep (encodesweep.h),
+//              compare_pixels (verify.h)
+//   results    Stats, Results, SampleLog (exrprofile.h), StatsSummary (stats.h), measure (timing.h),
+//              write_json, write_csv, compare_to_baseline, report_results (report.h)
+//
+// OpenEXR's global thread pool is process wide: the read and encode calls size it as the CLI does.
+#include "exrprofile.h"
+#include "timing.h"
+#include "stats.h"
+#include "threadpool.h"
+#include "bufferpool.h"
+#include "mtread.h"
+#include "coreread.h"
+#include "isolate.h"
+#include "synthetic.h"
+#include "encode.h"
+#include "encodesweep.h"
+#include "verify.h"
+#include "report.h"
@@ -3,74 +3,278 @@
 //
 #include "exrprofile.h"
 #include "mtread.h"
+#include "tiledread.h"
+#include "perfcount.h"
 
 
 namespace exrprofile {
 
-    void read_region(const std::string &filename, int y_start, int y_end, int width, std::atomic<int> &completed) {
+    std::unique_ptr<Imf::IStream> open_frame(const std::string &filename, const ReadOptions &options,
+                                             const StagedFile *staged) {
+        if (staged)
+            return std::make_unique<MemoryIStream>(filename, staged->bytes.get(), staged->size);
+        return open_istream(filename, options.io);
+    }
+
+    long fetch_frame(const std::string &filename, const ReadOptions &options, StagedFile &staged) {
+        if (options.cache == CacheMode::none || options.prefetched)
+            return 0;
+        if (options.cache == CacheMode::cold && !evict_file(filename))
+            std::cerr << "Could not evict " << filename << " from page cache, reading it warm." << std::endl;
+        const auto start_fetch = Clock::now();
+        staged = stage_file(filename, options.cache == CacheMode::direct);
+        return elapsed_ns(start_fetch);
+    }
+
+    ScanlineFile::ScanlineFile(Imf::IStream &stream, const ReadOptions &options) {
+        if (!options.generic_read()) {
+            rgba = std::make_unique<Imf::RgbaInputFile>(stream, file_thread_count(options));
+            return;
+        }
+        generic = std::make_unique<Imf::InputFile>(stream, file_thread_count(options));
+        std::vector<std::string> missing;
+        layout = layout_for(generic->header().channels(), options.channels, options.pixel_type, &missing);
+        warn_missing_channels(missing);
+    }
+
+    const Imath::Box2i &ScanlineFile::dataWindow() const {
+        return rgba ? rgba->dataWindow() : generic->header().dataWindow();
+    }
+
+    Imf::Compression ScanlineFile::compression() const {
+        return rgba ? rgba->compression() : generic->header().compression();
+    }
+
+    size_t ScanlineFile::pixel_size() const {
+        return rgba ? sizeof(Imf::Rgba) : layout.pixel_size;
+    }
+
+    void ScanlineFile::set_buffer(char *storage, const Imath::Box2i &window) {
+        if (rgba) {
+            const int width = window.max.x - window.min.x + 1;
+            rgba->setFrameBuffer(reinterpret_cast<Imf::Rgba *>(storage) - window.min.x - window.min.y * width, 1, width);
+        } else {
+            generic->setFrameBuffer(frame_buffer_for(layout, window, storage));
+        }
+    }
+
+    void ScanlineFile::read(int y_start, int y_end) {
+        if (rgba)
+            rgba->readPixels(y_start, y_end);
+        else
+            generic->readPixels(y_start, y_end);
+    }
+
+    const char *partition_name(const Partition partition) {
+        switch (partition) {
+            case Partition::stripes: return "stripes";
+            case Partition::dynamic: return "dynamic";
+            default: return "aligned";
+        }
+    }
+
+    int scanlines_per_chunk(const Imf::Compression compression) {
+        // OpenEXR's own table, so codecs newer than this code (e.g. HTJ2K) get their real chunk height
+        return std::max(Imf::getCompressionNumScanlines(compression), 1);
+    }
+
+    RegionPlan plan_regions(const Imath::Box2i &dw, int parts, const int lines_per_chunk, const Partition partition) {
+        RegionPlan plan;
+        const int height = dw.max.y - dw.min.y + 1;
+        plan.lines_per_chunk = std::max(lines_per_chunk, 1);
+        plan.chunks = (height + plan.lines_per_chunk - 1) / plan.lines_per_chunk;
+        parts = std::max(parts, 1);
+
+        if (partition == Partition::stripes) {
+            const int chunk_size = height / parts;
+            for (int i = 0; i < parts; ++i) {
+                int y_start = dw.min.y + i * chunk_size;
+                int y_end = (i == parts - 1) ? dw.max.y : y_start + chunk_size - 1;
+                if (y_end >= y_start)
+                    plan.regions.emplace_back(y_start, y_end);
+            }
+        } else {
+            // Aligned: spread whole chunks evenly over the parts. Dynamic: one region per chunk.
+            const long count = partition == Partition::dynamic ? plan.chunks : std::min<long>(parts, plan.chunks);
+            for (long i = 0; i < count; ++i) {
+                const long first = i * plan.chunks / count;
+                const long last = (i + 1) * plan.chunks / count - 1;
+                if (last < first) continue;
+                plan.regions.emplace_back(dw.min.y + static_cast<int>(first * plan.lines_per_chunk),
+                                          std::min(dw.max.y, dw.min.y + static_cast<int>((last + 1) * plan.lines_per_chunk) - 1));
+            }
+        }
+
+        // Every region decodes each chunk it touches, so whatever goes over the chunk count is wasted work.
+        long touched = 0;
+        for (const auto &[y_start, y_end]: plan.regions)
+            touched += (y_end - dw.min.y) / plan.lines_per_chunk - (y_start - dw.min.y) / plan.lines_per_chunk + 1;
+        plan.redundant_chunks = touched - plan.chunks;
+        return plan;
+    }
+
+    void read_region(const std::string &filename, RegionCursor &cursor, int width, std::atomic<int> &completed,
+                     std::atomic<long> &setup_ns, std::atomic<long> &alloc_ns, const ReadOptions &options,
+                     const StagedFile *staged) {
         try {
-            Imf::RgbaInputFile file(filename.c_str());
+            Rows rows;
+            if (!cursor.take(rows))
+                return; // someone else was faster, don't pay for an open
+
+            const auto start_open = Clock::now();
+            const auto stream = open_frame(filename, options, staged);
+            ScanlineFile file(*stream, options);
             Imath::Box2i dw = file.dataWindow();
-            int height = dw.max.y - dw.min.y + 1;
+            setup_ns.fetch_add(elapsed_ns(start_open), std::memory_order_relaxed);
 
-            // Allocate storage for the region
-            std::vector<Imf::Rgba> pixels(width * (y_end - y_start + 1));
+            BufferPool::Buffer pixels;
+            do {
+                const auto [y_start, y_end] = rows;
+                // Storage for the region, from the pool unless the last one is big enough
+                const size_t bytes = file.pixel_size() * width * (y_end - y_start + 1);
+                if (pixels.size() < bytes) {
+                    pixels = buffer_pool().acquire(bytes);
+                    alloc_ns.fetch_add(pixels.cost_ns(), std::memory_order_relaxed);
+                }
 
-            file.setFrameBuffer(pixels.data() - dw.min.x - y_start * width, 1, width);
-            file.readPixels(y_start, y_end);
+                file.set_buffer(pixels.data(), Imath::Box2i(Imath::V2i(dw.min.x, y_start), Imath::V2i(dw.max.x, y_end)));
+                {
+                    PerfScope counters("region-caller");
+                    file.read(y_start, y_end);
+                }
 
-            // Track the number of completed regions
-            completed.fetch_add(1, std::memory_order_relaxed);
-            std::cout << "Read region from Y: " << y_start << " to Y: " << y_end << " by thread "
-                      << std::this_thread::get_id() << std::endl;
+                // Track the number of completed regions
+                completed.fetch_add(1, std::memory_order_relaxed);
+                if (!options.quiet)
+                    std::cout << "Read region from Y: " << y_start << " to Y: " << y_end << " by thread "
+                              << std::this_thread::get_id() << std::endl;
+            } while (cursor.take(rows));
 
         } catch (const std::exception &e) {
             std::cerr << "Error reading EXR file region: " << e.what() << std::endl;
         }
     }
 
-    long multithreaded_read(const std::string & filename, const int num_threads, ThreadPool & pool) {
+    void read_shared_region(ScanlineFile &file, RegionCursor &cursor, std::atomic<int> &completed, const bool quiet) {
+        try {
+            // Frame buffer was set up once by the caller. OpenEXR serializes readPixels() on a single
+            // file, so the parallelism here comes from its own (global) line buffer threads.
+            Rows rows;
+            while (cursor.take(rows)) {
+                const auto [y_start, y_end] = rows;
+                {
+                    PerfScope counters("region-caller");
+                    file.read(y_start, y_end);
+                }
+
+                completed.fetch_add(1, std::memory_order_relaxed);
+                if (!quiet)
+                    std::cout << "Read shared region from Y: " << y_start << " to Y: " << y_end << " by thread "
+                              << std::this_thread::get_id() << std::endl;
+            }
+
+        } catch (const std::exception &e) {
+            std::cerr << "Error reading EXR file region: " << e.what() << std::endl;
+        }
+    }
 
+    Stats multithreaded_read(const std::string & filename, const int num_threads, ThreadPool & pool,
+                             const ReadOptions & options) {
 
-        // Set global thread count for OpenEXR
-        Imf::setGlobalThreadCount(num_threads);
-        std::cout << "Using " << num_threads << " OpenEXR threads." << std::endl;
 
-        long result = 0;
+        // Set global thread count for OpenEXR, unless every file gets its own
+        if (options.file_threads <= 0)
+            Imf::setGlobalThreadCount(num_threads);
+        if (!options.quiet)
+            std::cout << "Using " << num_threads << " OpenEXR threads (" << backend_name(options.io) << " I/O, "
+                      << cache_mode_name(options.cache) << " cache)." << std::endl;
+
+        Stats result{};
 
         try {
-            Imf::RgbaInputFile file(filename.c_str());
+            // Fetch the raw bytes first, so the decode below never waits on storage.
+            StagedFile staged;
+            const long fetch_ns = fetch_frame(filename, options, staged);
+            const StagedFile *source = options.prefetched ? options.prefetched
+                                                          : options.cache != CacheMode::none ? &staged : nullptr;
+
+            const auto start_open = Clock::now();
+            const auto stream = open_frame(filename, options, source);
+            ScanlineFile file(*stream, options);
+            const auto open_time = elapsed_ns(start_open);
             Imath::Box2i dw = file.dataWindow();
             int width = dw.max.x - dw.min.x + 1;
             int height = dw.max.y - dw.min.y + 1;
 
-            int chunk_size = height / num_threads;
-            std::vector<std::thread> threads;
+            const auto plan = plan_regions(dw, num_threads, scanlines_per_chunk(file.compression()), options.partition);
+            RegionCursor cursor(plan.regions);
+            TaskGroup regions;
             std::atomic<int> completed(0);
+            std::atomic<long> setup_ns(0);
 
-            const auto start_decompress = std::chrono::high_resolution_clock::now();
-            // Launch threads to read different regions of the image
+            // In shared mode all regions land in one frame-sized buffer owned by the file we just opened.
+            std::atomic<long> alloc_ns(0);
+            BufferPool::Buffer pixels;
+            if (options.shared_file) {
+                pixels = buffer_pool().acquire(file.pixel_size() * width * height);
+                alloc_ns = pixels.cost_ns();
+                file.set_buffer(pixels.data(), dw);
+            }
 
-            for (int i = 0; i < num_threads; ++i) {
-                int y_start = dw.min.y + i * chunk_size;
-                int y_end = (i == num_threads - 1) ? dw.max.y : y_start + chunk_size - 1;
-//                pool.enqueue() this should be here, but needs work.
-                threads.emplace_back([&, y_start, y_end]() {
-                    read_region(std::ref(filename), y_start, y_end, width, std::ref(completed));
-                });
+            const auto start_decompress = Clock::now();
+            // Schedule region readers on the shared pool. They are spread over the workers' deques and
+            // whoever is idle (e.g. done with another frame's regions) steals them from there. Static partitions
+            // get a reader per region, dynamic one per thread, each pulling chunks until none are left.
+            const size_t readers = options.partition == Partition::dynamic
+                                   ? std::min<size_t>(num_threads, plan.regions.size()) : plan.regions.size();
+            for (size_t i = 0; i < readers; ++i) {
+                if (options.shared_file) {
+                    pool.enqueue(regions, [&]() {
+                        read_shared_region(file, cursor, completed, options.quiet);
+                    });
+                } else {
+                    pool.enqueue(regions, [&]() {
+                        read_region(filename, cursor, width, completed, setup_ns, alloc_ns, options, source);
+                    });
+                }
+            }
+            // Sleeps until all of our regions are done.
+            pool.wait(regions);
+            const auto end_decompress = Clock::now();
 
+            auto decompression_ns = elapsed_ns(start_decompress, end_decompress);
+            // Shared mode pays the open once, up front. Count it in so both modes measure the whole frame.
+            if (options.shared_file) {
+                decompression_ns += open_time;
+                setup_ns = open_time;
+            }
+            // In per-region mode every thread pays for its own open; the setup share is the summed
+            // open time against the summed thread time.
+            const double busy_ns = options.shared_file ? (double) decompression_ns
+                                                       : (double) decompression_ns * num_threads;
+            const double setup_share = busy_ns > 0 ? 100.0 * (double) setup_ns.load() / busy_ns : 0.0;
 
+            if (source) {
+                result[Records::fetch] = fetch_ns;
+                result[Records::decode] = decompression_ns;
+                decompression_ns += fetch_ns;
             }
-            for (auto & thread: threads) {
-                thread.join();
+            if (!options.quiet) {
+                if (source) {
+                    fmt::print("{:>15}: {:.6f} seconds\n", "fetch", ns_to_seconds(fetch_ns));
+                    fmt::print("{:>15}: {:.6f} seconds\n", "decode", ns_to_seconds(result[Records::decode]));
+                }
+                fmt::print("{:>15}: {:.6f} seconds\n", "decompression", ns_to_seconds(decompression_ns));
+                fmt::print("{:>15}: {:.3f} ms ({:.1f}% of frame, {})\n", "setup", ns_to_ms(setup_ns.load()),
+                           setup_share, options.shared_file ? "opened once" : "opened per region");
+                fmt::print("{:>15}: {} of {} chunks ({} scanlines each)\n", "redundant", plan.redundant_chunks,
+                           plan.chunks, plan.lines_per_chunk);
+                std::cout << "All regions read. Total completed: " << completed.load() << std::endl;
             }
-            const auto end_decompress = std::chrono::high_resolution_clock::now();
-
-            const auto decompression_time = std::chrono::duration_cast<std::chrono::milliseconds>(
-                    end_decompress - start_decompress).count();
-            fmt::print("{:>15}: {:.6f} seconds\n", "decompression", (double) decompression_time / 1024);
-            std::cout << "All regions read. Total completed: " << completed.load() << std::endl;
-            result = decompression_time;
+            result[Records::decompression] = decompression_ns;
+            result[Records::setup] = setup_ns.load();
+            result[Records::redundant] = plan.redundant_chunks;
+            result[Records::alloc] = alloc_ns.load();
 
         } catch (const std::exception &e) {
             std::cerr << "Error reading EXR file: " << e.what() << std::endl;
@@ -78,4 +282,126 @@ namespace exrprofile {
         return result;
     }
 
-}
\ No newline at end of file
+    Stats read_frame(const std::string & filename, const int num_threads, ThreadPool & pool,
+                     const ReadOptions & options) {
+        if (options.part_reader || needs_part_reader(filename, options.prefetched))
+            return multipart_read(filename, num_threads, pool, options);
+        return multithreaded_read(filename, num_threads, pool, options);
+    }
+
+    int file_thread_count(const ReadOptions & options) {
+        return options.file_threads > 0 ? options.file_threads : Imf::globalThreadCount();
+    }
+
+    void load_exr_stream(Imf::IStream &stream, const ReadOptions &options) {
+        try {
+            ScanlineFile file(stream, options);
+            Imath::Box2i dw = file.dataWindow();
+            size_t width = dw.max.x - dw.min.x + 1;
+            size_t height = dw.max.y - dw.min.y + 1;
+
+            const auto pixels = buffer_pool().acquire(file.pixel_size() * width * height);
+            file.set_buffer(pixels.data(), dw);
+            file.read(dw.min.y, dw.max.y);
+        } catch (const std::exception &e) {
+            std::cerr << "Error loading EXR file: " << e.what() << std::endl;
+        }
+    }
+
+    void load_exr_file(const std::string &filename, const ReadOptions &options) {
+        try {
+            const auto stream = open_istream(filename, options.io);
+            load_exr_stream(*stream, options);
+        } catch (const std::exception &e) {
+            std::cerr << "Error loading EXR file: " << e.what() << std::endl;
+        }
+    }
+
+    PassCollector::PassCollector(const size_t workers, const size_t frames)
+            : slots(std::max<size_t>(workers, 1)), total(frames) {
+        // room for an uneven share, so appends don't reallocate in the middle of a pass
+        for (auto &slot: slots)
+            slot.frames.reserve(2 * frames / slots.size() + 1);
+    }
+
+    void PassCollector::record(const size_t worker, const size_t frame, const Stats &stats) {
+        Slot &slot = slots[worker];
+        slot.frames.emplace_back(frame, stats);
+        slot.busy_ns.store(slot.busy_ns.load(std::memory_order_relaxed) + stats[Records::decompression],
+                           std::memory_order_relaxed);
+        slot.done.store(slot.frames.size(), std::memory_order_relaxed);
+    }
+
+    PassCollector::Progress PassCollector::progress() const {
+        Progress progress;
+        for (const auto &slot: slots) {
+            progress.frames += slot.done.load(std::memory_order_relaxed);
+            progress.busy_ns += slot.busy_ns.load(std::memory_order_relaxed);
+        }
+        return progress;
+    }
+
+    std::vector<Stats> PassCollector::merge() {
+        std::vector<Stats> frames(total);
+        for (auto &slot: slots) {
+            for (const auto &[frame, stats]: slot.frames)
+                frames[frame] = stats;
+            slot.frames.clear();
+        }
+        return frames;
+    }
+
+    ProgressPrinter::ProgressPrinter(const PassCollector &collector, const double seconds) {
+        if (seconds <= 0.0)
+            return;
+        printer = std::thread([this, &collector, seconds]() {
+            const auto start = Clock::now();
+            auto next = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+            while (!finished.load(std::memory_order_relaxed)) {
+                // short naps, so the pass doesn't wait for a whole interval at its end
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                if (Clock::now() < next)
+                    continue;
+                next += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+                const auto progress = collector.progress();
+                fmt::print("{:>15}: {}/{} frames | {:.2f} fps | {:.3f} ms per frame\n", "progress", progress.frames,
+                           collector.size(), (double) progress.frames / std::max(ns_to_seconds(elapsed_ns(start)), 1e-9),
+                           progress.frames ? ns_to_ms((double) progress.busy_ns / (double) progress.frames) : 0.0);
+            }
+        });
+    }
+
+    ProgressPrinter::~ProgressPrinter() {
+        finished = true;
+        if (printer.joinable())
+            printer.join();
+    }
+
+    PassResult read_pass(const std::vector<std::string> & files, const int workers, const FrameReader & reader,
+                         const double progress) {
+        PassResult pass;
+        PassCollector collector(std::max(workers, 1), files.size());
+        std::atomic<size_t> frame_index{0};
+
+        const auto start = Clock::now();
+        {
+            ProgressPrinter printer(collector, progress);
+            // Frame loops get threads of their own: they mostly sleep waiting for their regions, and on the
+            // pool they could be stolen by, and nested into, a thread timing another frame.
+            std::vector<std::thread> frame_workers;
+            for (int i = 0; i < std::max(workers, 1); ++i) {
+                frame_workers.emplace_back([&, i]() {
+                    // every worker keeps taking the next frame of the list
+                    for (size_t frame = frame_index.fetch_add(1); frame < files.size(); frame = frame_index.fetch_add(1))
+                        collector.record(i, frame, reader(files[frame]));
+                });
+            }
+            for (auto &worker: frame_workers)
+                worker.join();
+            pass.wall_ns = elapsed_ns(start);
+        }
+        pass.frames = collector.merge();
+        return pass;
+    }
+
+}
@@ -14,12 +14,178 @@
 #include <vector>
 #include <atomic>
 #include <chrono>
+#include <functional>
 #include <fmt/core.h>
 #include "threadpool.h"
+#include "exrprofile.h"
+#include "streams.h"
+#include "bufferpool.h"
+#include "framebuffer.h"
+#include "timing.h"
 
 namespace exrprofile {
 
-    void read_region(const std::string &filename, int y_start, int y_end, int width, std::atomic<int> &completed);
-    long multithreaded_read(const std::string & filename, int num_threads, ThreadPool &);
+    // How a frame is cut into regions for the region readers
+    enum class Partition {
+        stripes,   // height / threads rows, ignoring chunks (boundary chunks get decoded twice)
+        aligned,   // same number of stripes, but cut on compression chunk boundaries
+        dynamic    // every chunk is a region, threads keep taking the next one until none are left
+    };
+
+    struct ReadOptions {
+        // Open a frame once (header + line offsets) and let all region readers decode from it,
+        // instead of every region re-opening the file on its own.
+        bool shared_file = false;
+        StreamBackend io = StreamBackend::stdio;
+        // Staging the file first splits the frame time into fetch (storage) and decode (CPU).
+        CacheMode cache = CacheMode::none;
+        Partition partition = Partition::aligned;
+        // Part reader (tiled / multipart files)
+        bool part_reader = false;   // use it for every file, not only the ones RgbaInputFile can't handle
+        int level = -1;             // only read this mip/rip level (-1: all of them)
+        int window = 0;             // only read a random window of N x N tiles per level (0: whole level)
+        // Generic reads through Imf::InputFile instead of RGBA half: a channel subset and/or
+        // an output pixel type (NUM_PIXELTYPES keeps the types stored in the file).
+        std::vector<std::string> channels;
+        Imf::PixelType pixel_type = Imf::NUM_PIXELTYPES;
+        bool native = false;        // generic read of every channel as stored, even without the two above
+        // Per file thread mode: > 0 is passed to every file's constructor and OpenEXR's global thread
+        // count is left to the caller. 0 sets the global count to the frame's threads on every read.
+        int file_threads = 0;
+        bool quiet = false;         // no per frame / per region output (sweeps)
+        double progress = 0.0;      // seconds between progress lines of a pass (0: none)
+        // Whole file fetched by someone else (the io_uring reader): decode from it, no fetch of our own.
+        const StagedFile *prefetched = nullptr;
+
+        bool generic_read() const { return native || !channels.empty() || pixel_type != Imf::NUM_PIXELTYPES; }
+    };
+
+    // Scanline file read either as RGBA half (RgbaInputFile, converts whatever is stored) or
+    // through a generic frame buffer with the channels and pixel type picked in ReadOptions.
+    class ScanlineFile {
+    public:
+        ScanlineFile(Imf::IStream &stream, const ReadOptions &options);
+
+        const Imath::Box2i &dataWindow() const;
+        Imf::Compression compression() const;
+        size_t pixel_size() const;
+        // storage has to hold pixel_size() bytes for every pixel of the window
+        void set_buffer(char *storage, const Imath::Box2i &window);
+        void read(int y_start, int y_end);
+
+    private:
+        std::unique_ptr<Imf::RgbaInputFile> rgba;
+        std::unique_ptr<Imf::InputFile> generic;
+        PixelLayout layout;
+    };
+
+    using Rows = std::pair<int, int>; // first and last scanline, inclusive
+
+    struct RegionPlan {
+        std::vector<Rows> regions;
+        int lines_per_chunk = 1;
+        long chunks = 0;
+        long redundant_chunks = 0; // chunks decoded by more than one region (counted once per extra decode)
+    };
+
+    const char *partition_name(Partition partition);
+
+    // Scanlines per compressed chunk of a scanline file, for the compression in its header
+    int scanlines_per_chunk(Imf::Compression compression);
+    RegionPlan plan_regions(const Imath::Box2i &dw, int parts, int lines_per_chunk, Partition partition);
+
+    // Work items (regions, tiles) are taken first come, first served by whichever reader asks next.
+    template<typename T>
+    class WorkCursor {
+    public:
+        explicit WorkCursor(const std::vector<T> &items) : items(items) {}
+        bool take(T &item) {
+            const size_t index = next.fetch_add(1, std::memory_order_relaxed);
+            if (index >= items.size()) return false;
+            item = items[index];
+            return true;
+        }
+    private:
+        const std::vector<T> &items;
+        std::atomic<size_t> next{0};
+    };
+    using RegionCursor = WorkCursor<Rows>;
+
+    // Staged frames are decoded from memory, everything else goes through the selected backend.
+    std::unique_ptr<Imf::IStream> open_frame(const std::string &filename, const ReadOptions &options,
+                                             const StagedFile *staged);
+    // Stages the file according to options.cache and returns the fetch time (ns), 0 without staging.
+    long fetch_frame(const std::string &filename, const ReadOptions &options, StagedFile &staged);
+
+    void read_region(const std::string &filename, RegionCursor &cursor, int width, std::atomic<int> &completed,
+                     std::atomic<long> &setup_ns, std::atomic<long> &alloc_ns, const ReadOptions &options = {},
+                     const StagedFile *staged = nullptr);
+    void read_shared_region(ScanlineFile &file, RegionCursor &cursor, std::atomic<int> &completed, bool quiet = false);
+    // Returns decompression, setup and buffer allocation times (ns), plus fetch and decode with a staging
+    // cache mode, and the number of redundantly decoded chunks. Other records are left empty.
+    Stats multithreaded_read(const std::string & filename, int num_threads, ThreadPool &, const ReadOptions & options = {});
+    // Picks multithreaded_read or the part reader (tiled / multipart files) for a frame.
+    Stats read_frame(const std::string & filename, int num_threads, ThreadPool &, const ReadOptions & options = {});
+
+    // Single file load: the whole data window of the first part in one read, into a pooled buffer.
+    // Errors are printed, not thrown (the compression sweep goes on with the next codec).
+    void load_exr_stream(Imf::IStream &stream, const ReadOptions &options = {});
+    void load_exr_file(const std::string &filename, const ReadOptions &options = {});
+
+    // Threads per file OpenEXR is told about: file_threads in per file mode, the global count otherwise.
+    int file_thread_count(const ReadOptions & options);
+
+    // One pass over a file list with `workers` frames in flight on the pool.
+    using FrameReader = std::function<Stats(const std::string &filename)>;
+    struct PassResult {
+        long wall_ns = 0;
+        std::vector<Stats> frames;   // same order as the file list
+    };
+
+    // Frame results of a pass, one cache line aligned slot per worker. A worker only ever writes its own
+    // slot, so recording a frame is an append, no lock, no lookup and no line shared with other workers.
+    // Frames go back in list order once all workers are done.
+    class PassCollector {
+    public:
+        PassCollector(size_t workers, size_t frames);
+
+        void record(size_t worker, size_t frame, const Stats &stats);
+        // Safe from any thread while workers run: relaxed sums over the slots, a moment's snapshot.
+        struct Progress {
+            size_t frames = 0;
+            long busy_ns = 0;       // summed frame times
+        };
+        Progress progress() const;
+        // After the join
+        std::vector<Stats> merge();
+        size_t size() const { return total; }
+
+    private:
+        struct alignas(64) Slot {
+            std::vector<std::pair<size_t, Stats>> frames;
+            std::atomic<size_t> done{0};
+            std::atomic<long> busy_ns{0};
+        };
+        std::vector<Slot> slots;
+        size_t total = 0;
+    };
+
+    // Prints a collector's progress every `seconds` from its own thread until it goes out of scope.
+    class ProgressPrinter {
+    public:
+        ProgressPrinter(const PassCollector &collector, double seconds);
+        ~ProgressPrinter();
+        ProgressPrinter(const ProgressPrinter &) = delete;
+        ProgressPrinter &operator=(const ProgressPrinter &) = delete;
+
+    private:
+        std::atomic<bool> finished{false};
+        std::thread printer;
+    };
+
+    // `workers` threads take frames off the list until it's empty. They are plain threads, the regions
+    // of their frames go to whatever pool the reader was given.
+    PassResult read_pass(const std::vector<std::string> & files, int workers, const FrameReader & reader,
+                         double progress = 0.0);
 
 }
\ No newline at end of file
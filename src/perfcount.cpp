@@ -0,0 +1,252 @@
+//
+// Created by symek on 7/5/25.
+//
+#include "perfcount.h"
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <utility>
+#include <fmt/core.h>
+
+namespace exrprofile {
+
+    namespace {
+
+        std::atomic<bool> enabled{false};
+        std::array<bool, PerfEvent::num_perf_events> kernel_excluded{};
+
+        std::mutex collected_mutex;
+        PerfPhases collected;
+
+        struct EventType {
+            uint32_t type;
+            uint64_t config;
+        };
+        constexpr std::array<EventType, PerfEvent::num_perf_events> event_types = {{
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+                {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES}}};
+
+        int current_tid() {
+            return static_cast<int>(::syscall(SYS_gettid));
+        }
+
+        int open_event(const PerfEvent event, const int tid, const bool exclude_kernel) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = event_types[event].type;
+            attr.config = event_types[event].config;
+            attr.exclude_kernel = exclude_kernel;
+            attr.exclude_hv = 1;
+            // scaled back up when the PMU had to multiplex our events with others
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            return static_cast<int>(::syscall(SYS_perf_event_open, &attr, tid, -1, -1, PERF_FLAG_FD_CLOEXEC));
+        }
+
+        uint64_t read_event(const int fd) {
+            if (fd < 0)
+                return 0;
+            uint64_t data[3] = {};   // value, time enabled, time running
+            if (::read(fd, data, sizeof(data)) != sizeof(data) || data[2] == 0)
+                return 0;
+            if (data[2] >= data[1])
+                return data[0];
+            return static_cast<uint64_t>((double) data[0] * (double) data[1] / (double) data[2]);
+        }
+
+        void record(const char *phase, const int tid, const PerfCounts &counts) {
+            std::scoped_lock lock(collected_mutex);
+            collected[phase][tid].add(counts);
+        }
+
+        // Counters of one thread, opened on its first scope and closed when it exits.
+        struct ThreadEvents {
+            std::array<int, PerfEvent::num_perf_events> fds{};
+            int tid = 0;
+
+            ThreadEvents() : tid(current_tid()) {
+                for (int e = 0; e < PerfEvent::num_perf_events; ++e)
+                    fds[e] = open_event(static_cast<PerfEvent>(e), 0, kernel_excluded[e]);
+            }
+            ~ThreadEvents() {
+                for (const int fd: fds)
+                    if (fd >= 0) ::close(fd);
+            }
+            PerfCounts read() const {
+                PerfCounts counts;
+                for (int e = 0; e < PerfEvent::num_perf_events; ++e)
+                    counts.values[e] = read_event(fds[e]);
+                return counts;
+            }
+        };
+
+        ThreadEvents &thread_events() {
+            thread_local ThreadEvents events;
+            return events;
+        }
+    }
+
+    const char *perf_event_name(const PerfEvent event) {
+        switch (event) {
+            case PerfEvent::cycles: return "cycles";
+            case PerfEvent::instructions: return "instructions";
+            case PerfEvent::llc_misses: return "llc_misses";
+            case PerfEvent::branch_misses: return "branch_misses";
+            case PerfEvent::context_switches: return "context_switches";
+            default: return "unknown";
+        }
+    }
+
+    double PerfCounts::ipc() const {
+        return values[PerfEvent::cycles] ? (double) values[PerfEvent::instructions] / (double) values[PerfEvent::cycles]
+                                         : 0.0;
+    }
+
+    double PerfCounts::misses_per_kilo_instruction(const PerfEvent event) const {
+        return values[PerfEvent::instructions]
+               ? 1000.0 * (double) values[event] / (double) values[PerfEvent::instructions] : 0.0;
+    }
+
+    void PerfCounts::add(const PerfCounts &other) {
+        for (int e = 0; e < PerfEvent::num_perf_events; ++e)
+            values[e] += other.values[e];
+        scopes += other.scopes;
+    }
+
+    bool enable_perf() {
+        // Try every counter on ourselves, with kernel counting if allowed, user space only otherwise.
+        int opened = 0;
+        int error = 0;
+        for (int e = 0; e < PerfEvent::num_perf_events; ++e) {
+            const auto event = static_cast<PerfEvent>(e);
+            int fd = open_event(event, 0, false);
+            if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+                fd = open_event(event, 0, true);
+                kernel_excluded[e] = true;
+            }
+            if (fd < 0) {
+                error = errno;
+                std::cerr << "Counter " << perf_event_name(event) << " not available: " << std::strerror(errno)
+                          << std::endl;
+                continue;
+            }
+            ::close(fd);
+            ++opened;
+        }
+        if (opened == 0) {
+            std::string paranoid = "unknown";
+            std::ifstream("/proc/sys/kernel/perf_event_paranoid") >> paranoid;
+            std::cerr << "Performance counters are not permitted (" << std::strerror(error)
+                      << ", perf_event_paranoid " << paranoid << "), running without them." << std::endl;
+            return false;
+        }
+        if (std::any_of(kernel_excluded.begin(), kernel_excluded.end(), [](const bool excluded) { return excluded; }))
+            std::cerr << "Some counters only count user space (perf_event_paranoid)." << std::endl;
+        enabled = true;
+        return true;
+    }
+
+    bool perf_enabled() {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    PerfScope::PerfScope(const char *phase) : phase(phase), active(perf_enabled()) {
+        if (active)
+            start = thread_events().read();
+    }
+
+    PerfScope::~PerfScope() {
+        if (!active)
+            return;
+        const auto &events = thread_events();
+        PerfCounts delta = events.read();
+        for (int e = 0; e < PerfEvent::num_perf_events; ++e)
+            delta.values[e] -= std::min(delta.values[e], start.values[e]);
+        delta.scopes = 1;
+        record(phase, events.tid, delta);
+    }
+
+    ProcessPerfScope::ProcessPerfScope(const char *phase) : phase(phase) {
+        if (!perf_enabled())
+            return;
+        std::error_code error;
+        for (const auto &task: std::filesystem::directory_iterator("/proc/self/task", error)) {
+            Task counted;
+            try {
+                counted.tid = std::stoi(task.path().filename().string());
+            } catch (const std::exception &) {
+                continue;
+            }
+            // counting starts as soon as an event is open
+            for (int e = 0; e < PerfEvent::num_perf_events; ++e)
+                counted.fds[e] = open_event(static_cast<PerfEvent>(e), counted.tid, kernel_excluded[e]);
+            tasks.push_back(counted);
+        }
+    }
+
+    ProcessPerfScope::~ProcessPerfScope() {
+        for (const auto &task: tasks) {
+            PerfCounts counts;
+            for (int e = 0; e < PerfEvent::num_perf_events; ++e) {
+                counts.values[e] = read_event(task.fds[e]);
+                if (task.fds[e] >= 0)
+                    ::close(task.fds[e]);
+            }
+            counts.scopes = 1;
+            // threads that slept through the phase are noise in the per thread report
+            if (counts.values[PerfEvent::instructions] > 0 || counts.values[PerfEvent::context_switches] > 0)
+                record(phase, task.tid, counts);
+        }
+    }
+
+    PerfPhases take_perf() {
+        std::scoped_lock lock(collected_mutex);
+        return std::exchange(collected, PerfPhases{});
+    }
+
+    void add_perf(PerfLog &log, const std::string &entry, const PerfPhases &phases) {
+        for (const auto &[phase, threads]: phases)
+            for (const auto &[tid, counts]: threads)
+                log[entry][phase].add(counts);
+    }
+
+    namespace {
+        void print_counts(const std::string &label, const PerfCounts &counts) {
+            fmt::print("{:>32}: {:>9.1f}M cycles {:>9.1f}M instr | IPC {:.2f} | LLC miss {:.2f}/ki | "
+                       "branch miss {:.2f}/ki | {} ctx switches\n", label,
+                       (double) counts.values[PerfEvent::cycles] / 1e6,
+                       (double) counts.values[PerfEvent::instructions] / 1e6, counts.ipc(),
+                       counts.misses_per_kilo_instruction(PerfEvent::llc_misses),
+                       counts.misses_per_kilo_instruction(PerfEvent::branch_misses),
+                       counts.values[PerfEvent::context_switches]);
+        }
+    }
+
+    void print_perf_log(const PerfLog &log) {
+        if (log.empty())
+            return;
+        fmt::print("\nPerformance counters:\n");
+        for (const auto &[entry, phases]: log)
+            for (const auto &[phase, counts]: phases)
+                print_counts(entry + " " + phase, counts);
+    }
+
+    void print_perf_threads(const PerfPhases &phases) {
+        for (const auto &[phase, threads]: phases) {
+            fmt::print("\nPerformance counters of {} per thread:\n", phase);
+            for (const auto &[tid, counts]: threads)
+                print_counts(fmt::format("tid {} ({} scopes)", tid, counts.scopes), counts);
+        }
+    }
+
+} // end of namespace exrprofile
@@ -0,0 +1,87 @@
+//
+// Created by symek on 7/5/25.
+//
+#pragma once
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace exrprofile {
+
+    // Hardware (and one software) counters read through perf_event_open(2), Linux only.
+    enum PerfEvent {
+        cycles = 0,
+        instructions = 1,
+        llc_misses = 2,         // PERF_COUNT_HW_CACHE_MISSES, last level cache misses on Intel and AMD
+        branch_misses = 3,
+        context_switches = 4,
+        num_perf_events
+    };
+    const char *perf_event_name(PerfEvent event);
+
+    struct PerfCounts {
+        std::array<uint64_t, PerfEvent::num_perf_events> values{};
+        uint64_t scopes = 0;     // measured stretches summed in here
+
+        double ipc() const;
+        double misses_per_kilo_instruction(PerfEvent event) const;
+        void add(const PerfCounts &other);
+    };
+
+    // Per phase, per thread (tid) counts collected since the last take_perf().
+    using PerfPhases = std::map<std::string, std::map<int, PerfCounts>>;
+    // Per results entry and phase, threads summed up. Reported next to the timings of the entry.
+    using PerfLog = std::map<std::string, std::map<std::string, PerfCounts>>;
+
+    // Turns counting on for the process. Returns false and says why when none of the counters may be
+    // opened (perf_event_paranoid, containers, VMs without a PMU), everything below is a no-op then.
+    // Counters which can't be opened on their own (e.g. LLC misses in some VMs) just stay at 0.
+    bool enable_perf();
+    bool perf_enabled();
+
+    // Counts the calling thread from construction to destruction into `phase`. Every thread keeps its
+    // counters open, so a scope costs a few reads, cheap enough for a region. Work the thread hands off
+    // (OpenEXR decoding line buffers on its global pool) is not in there, only the waiting for it.
+    class PerfScope {
+    public:
+        explicit PerfScope(const char *phase);
+        ~PerfScope();
+        PerfScope(const PerfScope &) = delete;
+        PerfScope &operator=(const PerfScope &) = delete;
+
+    private:
+        const char *phase;
+        bool active = false;
+        PerfCounts start;
+    };
+
+    // Counts every thread the process has when it starts (OpenEXR's pool, ours, the main thread)
+    // until it ends. Opens and closes counters for all of them, so only for whole phases and outside
+    // of what they time. Threads started in the meantime are not counted.
+    class ProcessPerfScope {
+    public:
+        explicit ProcessPerfScope(const char *phase);
+        ~ProcessPerfScope();
+        ProcessPerfScope(const ProcessPerfScope &) = delete;
+        ProcessPerfScope &operator=(const ProcessPerfScope &) = delete;
+
+    private:
+        struct Task {
+            int tid = 0;
+            std::array<int, PerfEvent::num_perf_events> fds{};
+        };
+        const char *phase;
+        std::vector<Task> tasks;
+    };
+
+    PerfPhases take_perf();
+    // Adds all phases, threads summed, under `entry`.
+    void add_perf(PerfLog &log, const std::string &entry, const PerfPhases &phases);
+
+    void print_perf_log(const PerfLog &log);
+    // Per thread lines of every phase, where imbalance and scaling cliffs show.
+    void print_perf_threads(const PerfPhases &phases);
+
+} // end of namespace exrprofile
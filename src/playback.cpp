@@ -0,0 +1,202 @@
+//
+// Created by symek on 6/14/25.
+//
+#include "playback.h"
+#include <OpenEXR/ImfInputFile.h>
+#include <OpenEXR/ImfHeader.h>
+#include <OpenEXR/ImfThreading.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace exrprofile {
+
+    namespace {
+        constexpr long not_ready = -1;
+    }
+
+    std::vector<Sequence> group_sequences(const std::vector<std::string> &files) {
+        std::vector<Sequence> sequences;
+        for (const auto &filename: files) {
+            std::string name;
+            try {
+                Imf::InputFile file(filename.c_str());
+                const Imath::Box2i &dw = file.header().dataWindow();
+                Imf::getCompressionNameFromId(file.header().compression(), name);
+                name += fmt::format(" {}x{}", dw.max.x - dw.min.x + 1, dw.max.y - dw.min.y + 1);
+            } catch (const std::exception &e) {
+                std::cerr << "Error reading header, skipping frame: " << e.what() << std::endl;
+                continue;
+            }
+            auto found = std::find_if(sequences.begin(), sequences.end(),
+                                      [&](const Sequence &sequence) { return sequence.name == name; });
+            if (found == sequences.end())
+                found = sequences.insert(sequences.end(), Sequence{name, {}});
+            found->frames.push_back(filename);
+        }
+        return sequences;
+    }
+
+    PlaybackRun play_sequence(const Sequence &sequence, const int depth, const double fps, const int threads,
+                              const int workers, ThreadPool &pool, const ReadOptions &options,
+                              const PoolReader &reader) {
+        const size_t count = sequence.frames.size();
+        PlaybackRun run;
+        run.depth = std::max(depth, 1);
+        run.min_ready = count;
+
+        // Everything below is guarded by the mutex. Times are ns since start.
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::vector<long> ready_at(count, not_ready);
+        size_t next = 0;        // next frame a decoder takes
+        size_t playhead = 0;    // frames before it are shown or dropped
+        long clock_start = 0;
+
+        // Decoders run concurrently, none of them may resize OpenEXR's global pool under the others.
+        ReadOptions own = options;
+        own.file_threads = threads;
+        if (Imf::globalThreadCount() != threads * workers)
+            Imf::setGlobalThreadCount(threads * workers);
+
+        const auto start = Clock::now();
+        std::vector<std::thread> decoders;
+        for (int i = 0; i < std::max(workers, 1); ++i) {
+            decoders.emplace_back([&]() {
+                while (true) {
+                    size_t frame;
+                    {
+                        std::unique_lock lock(mutex);
+                        changed.wait(lock, [&]() {
+                            next = std::max(next, playhead);   // dropped frames aren't worth decoding
+                            return next >= count || next < playhead + run.depth;
+                        });
+                        if (next >= count)
+                            return;
+                        frame = next++;
+                    }
+                    long decode_ns = 0;
+                    try {
+                        decode_ns = reader(sequence.frames[frame], pool, own)[Records::decompression];
+                    } catch (const std::exception &e) {
+                        std::cerr << "Error decoding " << sequence.frames[frame] << ": " << e.what() << std::endl;
+                    }
+                    {
+                        std::scoped_lock lock(mutex);
+                        ready_at[frame] = elapsed_ns(start);
+                        run.frames.push_back(decode_ns);
+                    }
+                    changed.notify_all();
+                }
+            });
+        }
+
+        // Preroll: the queue fills up before the clock starts, like a player does on play.
+        {
+            std::unique_lock lock(mutex);
+            changed.wait(lock, [&]() {
+                return std::all_of(ready_at.begin(), ready_at.begin() + std::min<size_t>(run.depth, count),
+                                   [](const long t) { return t != not_ready; });
+            });
+            clock_start = elapsed_ns(start);
+        }
+        run.preroll_ns = clock_start;
+
+        const auto period = std::chrono::duration<double>(1.0 / std::max(fps, 0.001));
+        const auto clock = start + std::chrono::nanoseconds(clock_start);
+        bool dropping = false;
+        for (size_t frame = 0; frame < count; ++frame) {
+            const auto tick = clock + std::chrono::duration_cast<Clock::duration>(period * frame);
+            std::this_thread::sleep_until(tick);
+            {
+                std::scoped_lock lock(mutex);
+                // Everything against the tick, not the wake up: a frame finished in between was late
+                const long tick_ns = elapsed_ns(start, tick);
+                auto in_time = [&](const size_t i) { return ready_at[i] != not_ready && ready_at[i] <= tick_ns; };
+                size_t ready = 0;
+                for (size_t i = frame; i < next; ++i)
+                    ready += in_time(i);
+                run.min_ready = std::min(run.min_ready, ready);
+
+                if (in_time(frame)) {
+                    ++run.shown;
+                    // how close the read-ahead came to dropping this one
+                    run.slack.push_back(tick_ns - ready_at[frame]);
+                    dropping = false;
+                } else {
+                    ++run.dropped;
+                    if (!dropping)
+                        ++run.underruns;
+                    dropping = true;
+                }
+                playhead = frame + 1;
+            }
+            changed.notify_all();
+        }
+
+        for (auto &decoder: decoders)
+            decoder.join();
+
+        // Throughput after preroll: frames decoded while the clock ran
+        long last_ready = clock_start;
+        size_t decoded = 0;
+        for (const long t: ready_at) {
+            if (t == not_ready || t <= clock_start) continue;
+            last_ready = std::max(last_ready, t);
+            ++decoded;
+        }
+        if (last_ready > clock_start)
+            run.decode_fps = (double) decoded / ns_to_seconds(last_ready - clock_start);
+        return run;
+    }
+
+    std::vector<PlaybackReport> playback(const std::vector<std::string> &files, const int threads, const int workers,
+                                         ThreadPool &pool, const ReadOptions &options, const PoolReader &reader,
+                                         const PlaybackOptions &playback_options) {
+        auto depths = playback_options.depths;
+        std::sort(depths.begin(), depths.end());
+        depths.erase(std::unique(depths.begin(), depths.end()), depths.end());
+
+        std::vector<PlaybackReport> reports;
+        for (auto &sequence: group_sequences(files)) {
+            auto &report = reports.emplace_back();
+            report.sequence = std::move(sequence);
+            fmt::print("=== Playing {} ({} frames) at {:g} fps\n", report.sequence.name,
+                       report.sequence.frames.size(), playback_options.fps);
+            for (const int depth: depths) {
+                report.runs.push_back(play_sequence(report.sequence, depth, playback_options.fps, threads, workers,
+                                                    pool, options, reader));
+                const auto &run = report.runs.back();
+                fmt::print("{:>15}: {} dropped, {} underruns\n", fmt::format("depth {}", run.depth), run.dropped,
+                           run.underruns);
+                if (run.dropped == 0) {
+                    report.min_depth = run.depth;
+                    break;
+                }
+            }
+        }
+        return reports;
+    }
+
+    void print_playback_report(const std::vector<PlaybackReport> &reports, const double fps) {
+        fmt::print("\nPlayback at {:g} fps:\n", fps);
+        for (const auto &report: reports) {
+            fmt::print("{} ({} frames):\n", report.sequence.name, report.sequence.frames.size());
+            for (const auto &run: report.runs) {
+                const auto slack = StatsSummary<long>::compute(run.slack, true);
+                fmt::print("{:>15}: {} shown, {} dropped, {} underruns, min ready {} | decode {:.2f} fps | "
+                           "preroll {:.3f} ms | slack min {:.3f} ms, median {:.3f} ms, stdev {:.3f} ms\n",
+                           fmt::format("depth {}", run.depth), run.shown, run.dropped, run.underruns, run.min_ready,
+                           run.decode_fps, ns_to_ms(run.preroll_ns), ns_to_ms((double) slack.min),
+                           ns_to_ms((double) slack.median.value_or(0)), ns_to_ms(slack.stdev));
+            }
+            if (report.min_depth > 0)
+                fmt::print("{:>15}: {} frames\n", "realtime depth", report.min_depth);
+            else if (!report.runs.empty())
+                fmt::print("{:>15}: none up to {} frames, decoding is too slow for {:g} fps\n", "realtime depth",
+                           report.runs.back().depth, fps);
+        }
+    }
+
+} // end of namespace exrprofile
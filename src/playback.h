@@ -0,0 +1,57 @@
+//
+// Created by symek on 6/14/25.
+//
+#pragma once
+#include <string>
+#include <vector>
+#include "isolate.h"
+#include "stats.h"
+
+namespace exrprofile {
+
+    struct PlaybackOptions {
+        double fps = 24.0;
+        std::vector<int> depths{1, 2, 4, 8, 16};   // read-ahead depths to try (decoded + decoding frames)
+    };
+
+    // A shot as a review tool plays it: frames of one compression and resolution, in list order.
+    struct Sequence {
+        std::string name;   // "PIZ 1920x1080"
+        std::vector<std::string> frames;
+    };
+    // Groups a file list by compression and data window size, keeping the order of the list.
+    std::vector<Sequence> group_sequences(const std::vector<std::string> &files);
+
+    // One playback of a sequence at one read-ahead depth.
+    struct PlaybackRun {
+        int depth = 1;
+        long preroll_ns = 0;        // until the queue was full and the clock started
+        size_t shown = 0;
+        size_t dropped = 0;         // not decoded at their presentation time
+        size_t underruns = 0;       // times the queue ran empty (runs of consecutive drops)
+        size_t min_ready = 0;       // fewest decoded frames waiting at any tick
+        double decode_fps = 0.0;    // frames decoded per second once the clock started
+        Samples slack;              // how long before its tick every shown frame was decoded (ns)
+        Samples frames;             // decode time of every decoded frame (ns)
+    };
+
+    // Frames are decoded in order by `workers` threads with `threads` threads each (per file, the global
+    // OpenEXR pool is sized once for all), never more than `depth` frames ahead of the playhead. The
+    // playhead starts once `depth` frames are decoded and takes a frame every 1/fps. A frame which isn't
+    // decoded by then is dropped, and frames behind the playhead are not decoded any more.
+    PlaybackRun play_sequence(const Sequence &sequence, int depth, double fps, int threads, int workers,
+                              ThreadPool &pool, const ReadOptions &options, const PoolReader &reader);
+
+    struct PlaybackReport {
+        Sequence sequence;
+        std::vector<PlaybackRun> runs;
+        int min_depth = 0;          // smallest depth that played without drops, 0 if none did
+    };
+
+    // Every sequence at the depths of options.depths, in increasing order until one plays clean.
+    std::vector<PlaybackReport> playback(const std::vector<std::string> &files, int threads, int workers,
+                                         ThreadPool &pool, const ReadOptions &options, const PoolReader &reader,
+                                         const PlaybackOptions &playback_options);
+    void print_playback_report(const std::vector<PlaybackReport> &reports, double fps);
+
+} // end of namespace exrprofile
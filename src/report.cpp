@@ -0,0 +1,358 @@
+//
+// Created by symek on 5/3/25.
+//
+#include "report.h"
+#include "stats.h"
+#include "timing.h"
+#include <OpenEXR/OpenEXRConfig.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+namespace exrprofile {
+
+    namespace {
+        constexpr std::array timed_records = {Records::compression, Records::decompression, Records::setup,
+                                              Records::fetch, Records::decode, Records::alloc};
+
+        // Continued fraction for the incomplete beta function (Numerical Recipes, betacf)
+        double beta_fraction(double a, double b, double x) {
+            constexpr int max_iterations = 300;
+            constexpr double epsilon = 3e-14;
+            constexpr double tiny = 1e-300;
+            const double qab = a + b, qap = a + 1.0, qam = a - 1.0;
+            double c = 1.0;
+            double d = 1.0 - qab * x / qap;
+            if (std::fabs(d) < tiny) d = tiny;
+            d = 1.0 / d;
+            double h = d;
+            for (int m = 1; m <= max_iterations; ++m) {
+                const int m2 = 2 * m;
+                double aa = m * (b - m) * x / ((qam + m2) * (a + m2));
+                d = 1.0 + aa * d;
+                if (std::fabs(d) < tiny) d = tiny;
+                c = 1.0 + aa / c;
+                if (std::fabs(c) < tiny) c = tiny;
+                d = 1.0 / d;
+                h *= d * c;
+                aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2));
+                d = 1.0 + aa * d;
+                if (std::fabs(d) < tiny) d = tiny;
+                c = 1.0 + aa / c;
+                if (std::fabs(c) < tiny) c = tiny;
+                d = 1.0 / d;
+                const double delta = d * c;
+                h *= delta;
+                if (std::fabs(delta - 1.0) < epsilon) break;
+            }
+            return h;
+        }
+
+        // Regularized incomplete beta I_x(a, b)
+        double incomplete_beta(double a, double b, double x) {
+            if (x <= 0.0) return 0.0;
+            if (x >= 1.0) return 1.0;
+            const double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b)
+                                          + a * std::log(x) + b * std::log(1.0 - x));
+            if (x < (a + 1.0) / (a + b + 2.0))
+                return front * beta_fraction(a, b, x) / a;
+            return 1.0 - front * beta_fraction(b, a, 1.0 - x) / b;
+        }
+
+        // One sided Welch's t-test, p-value of "current is slower than baseline"
+        double welch_p_value(const StatsSummary<double> &baseline, const StatsSummary<double> &current) {
+            const auto n1 = static_cast<double>(baseline.count), n2 = static_cast<double>(current.count);
+            // sample (not population) variances
+            const double v1 = baseline.stdev * baseline.stdev * n1 / (n1 - 1);
+            const double v2 = current.stdev * current.stdev * n2 / (n2 - 1);
+            const double se2 = v1 / n1 + v2 / n2;
+            if (se2 <= 0.0)
+                return current.mean > baseline.mean ? 0.0 : 1.0;
+            const double t = (current.mean - baseline.mean) / std::sqrt(se2);
+            const double df = se2 * se2 / ((v1 / n1) * (v1 / n1) / (n1 - 1) + (v2 / n2) * (v2 / n2) / (n2 - 1));
+            const double tail = 0.5 * incomplete_beta(df / 2.0, 0.5, df / (df + t * t));
+            return t > 0 ? tail : 1.0 - tail;
+        }
+
+        template<typename Range>
+        StatsSummary<double> summarize(const Range &values) {
+            StatsSummary<double> summary;
+            for (const auto &value: values)
+                summary.add(static_cast<double>(value));
+            return summary;
+        }
+
+        std::string csv_escape(const std::string &value) {
+            if (value.find_first_of(",\"\n") == std::string::npos)
+                return value;
+            std::string quoted = "\"";
+            for (const char c: value) {
+                if (c == '"') quoted += '"';
+                quoted += c;
+            }
+            return quoted + "\"";
+        }
+    }
+
+    const char *record_name(const Records record) {
+        switch (record) {
+            case Records::compression: return "compression";
+            case Records::decompression: return "decompression";
+            case Records::filesize: return "filesize";
+            case Records::setup: return "setup";
+            case Records::fetch: return "fetch";
+            case Records::decode: return "decode";
+            case Records::redundant: return "redundant";
+            case Records::alloc: return "alloc";
+            default: return "unknown";
+        }
+    }
+
+    nlohmann::json host_info() {
+        nlohmann::json host;
+        char hostname[256] = {};
+        ::gethostname(hostname, sizeof(hostname) - 1);
+        host["hostname"] = hostname;
+        struct utsname system{};
+        if (::uname(&system) == 0) {
+            host["os"] = std::string(system.sysname) + " " + system.release;
+            host["machine"] = system.machine;
+        }
+        std::ifstream cpuinfo("/proc/cpuinfo");
+        for (std::string line; std::getline(cpuinfo, line);) {
+            if (line.rfind("model name", 0) == 0) {
+                host["cpu"] = line.substr(line.find(':') + 2);
+                break;
+            }
+        }
+        host["cores"] = std::thread::hardware_concurrency();
+        host["openexr"] = OPENEXR_VERSION_STRING;
+
+        char timestamp[32] = {};
+        const std::time_t now = std::time(nullptr);
+        std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+        host["time"] = timestamp;
+        return host;
+    }
+
+    nlohmann::json results_to_json(const Results &results, const SampleLog &samples, const RunInfo &run,
+                                   const PerfLog &perf) {
+        nlohmann::json document;
+        document["version"] = 1;
+        document["mode"] = run.mode;
+        document["config"] = run.config;
+        document["host"] = host_info();
+
+        auto &entries = document["entries"] = nlohmann::json::object();
+        for (const auto &[name, stat]: results) {
+            auto &entry = entries[name];
+            entry["filesize"] = stat[Records::filesize];
+            entry["redundant_chunks"] = stat[Records::redundant];
+            auto &records = entry["records"] = nlohmann::json::object();
+            const auto found = samples.find(name);
+            for (const auto record: timed_records) {
+                const Samples *values = found != samples.end() ? &found->second[record] : nullptr;
+                if (stat[record] == 0 && (!values || values->empty()))
+                    continue;
+                auto &out = records[record_name(record)];
+                out["median_ns"] = stat[record];
+                out["samples"] = values ? *values : Samples{};
+                if (values && !values->empty()) {
+                    const auto summary = StatsSummary<long>::compute(*values, true);
+                    out["mean_ns"] = summary.mean;
+                    out["stdev_ns"] = summary.stdev;
+                    out["p99_ns"] = summary.p99;
+                }
+            }
+        }
+
+        for (const auto &[name, phases]: perf) {
+            for (const auto &[phase, counts]: phases) {
+                auto &out = document["counters"][name][phase];
+                for (int e = 0; e < PerfEvent::num_perf_events; ++e)
+                    out[perf_event_name(static_cast<PerfEvent>(e))] = counts.values[e];
+                out["ipc"] = counts.ipc();
+                out["scopes"] = counts.scopes;
+            }
+        }
+        return document;
+    }
+
+    void write_json(const std::string &path, const Results &results, const SampleLog &samples, const RunInfo &run,
+                    const PerfLog &perf) {
+        std::ofstream file(path);
+        if (!file.is_open())
+            throw std::runtime_error("Could not write results: " + path);
+        file << results_to_json(results, samples, run, perf).dump(2) << std::endl;
+    }
+
+    void write_csv(const std::string &path, const Results &results, const SampleLog &samples, const RunInfo &run) {
+        std::ofstream file(path);
+        if (!file.is_open())
+            throw std::runtime_error("Could not write results: " + path);
+
+        // scalar config values become extra columns, so every row stands on its own
+        std::vector<std::pair<std::string, std::string>> config;
+        for (const auto &[key, value]: run.config.items())
+            config.emplace_back(key, value.is_string() ? value.get<std::string>() : value.dump());
+        const auto host = host_info();
+
+        file << "name,record,repetition,value_ns,filesize,mode,host";
+        for (const auto &[key, value]: config)
+            file << ',' << csv_escape(key);
+        file << '\n';
+
+        for (const auto &[name, stat]: results) {
+            const auto found = samples.find(name);
+            for (const auto record: timed_records) {
+                const Samples values = found != samples.end() && !found->second[record].empty()
+                                       ? found->second[record] : (stat[record] ? Samples{stat[record]} : Samples{});
+                for (size_t i = 0; i < values.size(); ++i) {
+                    file << csv_escape(name) << ',' << record_name(record) << ',' << i << ',' << values[i] << ','
+                         << stat[Records::filesize] << ',' << run.mode << ','
+                         << csv_escape(host.value("hostname", ""));
+                    for (const auto &[key, value]: config)
+                        file << ',' << csv_escape(value);
+                    file << '\n';
+                }
+            }
+        }
+    }
+
+    nlohmann::json read_json(const std::string &path) {
+        std::ifstream file(path);
+        if (!file.is_open())
+            throw std::runtime_error("Could not open baseline: " + path);
+        return nlohmann::json::parse(file);
+    }
+
+    std::vector<Regression> compare_to_baseline(const nlohmann::json &baseline, const Results &results,
+                                                const SampleLog &samples, const double threshold, const double alpha) {
+        std::vector<Regression> regressions;
+        if (!baseline.contains("entries"))
+            return regressions;
+        const auto &entries = baseline["entries"];
+
+        for (const auto &[name, stat]: results) {
+            if (!entries.contains(name))
+                continue;
+            const auto &records = entries[name]["records"];
+            const auto found = samples.find(name);
+            for (const auto record: timed_records) {
+                if (!records.contains(record_name(record)))
+                    continue;
+                auto before = records[record_name(record)]["samples"].get<Samples>();
+                if (before.empty())
+                    before.push_back(records[record_name(record)]["median_ns"].get<long>());
+                Samples after = found != samples.end() ? found->second[record] : Samples{};
+                if (after.empty())
+                    after.push_back(stat[record]);
+
+                const auto old_stats = summarize(before);
+                const auto new_stats = summarize(after);
+                if (old_stats.mean <= 0.0)
+                    continue;
+
+                Regression regression{name, record, old_stats.mean, new_stats.mean, new_stats.mean / old_stats.mean};
+                if (old_stats.count > 1 && new_stats.count > 1)
+                    regression.p_value = welch_p_value(old_stats, new_stats);
+                const bool enough_samples = old_stats.count > 1 && new_stats.count > 1;
+                regression.significant = regression.ratio > 1.0 + threshold &&
+                                         (!enough_samples || regression.p_value < alpha);
+                regressions.push_back(regression);
+            }
+        }
+        return regressions;
+    }
+
+    void print_sorted_stats(const exrprofile::Results & results) {
+        // Convert map to vector of pairs for sorting FIXME: make stats container suitable for sorting
+        std::vector<std::pair<std::string, exrprofile::Stats>> sorted_results(results.begin(), results.end());
+
+        using namespace exrprofile;
+        std::cout << "\nSorted by Compression Time:\n";
+        std::sort(sorted_results.begin(), sorted_results.end(),
+                  [](const auto &a, const auto &b) {
+                      return a.second[Records::compression] < b.second[Records::compression];
+                  });
+        for (const auto &[name, stat]: sorted_results) {
+            fmt::print("{:>25}: {:.3f} ms -> size: {:.2f}MB \n", name, ns_to_ms(stat[Records::compression]),
+                       (double) stat[Records::filesize] / (1024 * 1024));
+        }
+
+        std::cout << "\nSorted by Decompression Time:\n";
+        std::sort(sorted_results.begin(), sorted_results.end(),
+                  [](const auto &a, const auto &b) {
+                      return a.second[Records::decompression] < b.second[Records::decompression];
+                  });
+        for (const auto &[name, stat]: sorted_results) {
+            fmt::print("{:>25}: {:.3f} ms -> size: {:.2f}MB \n", name, ns_to_ms(stat[Records::decompression]),
+                       (double) stat[Records::filesize] / (1024 * 1024));
+        }
+
+        std::cout << "\nSorted by File Size:\n";
+        std::sort(sorted_results.begin(), sorted_results.end(),
+                  [](const auto &a, const auto &b) { return a.second[Records::filesize] < b.second[Records::filesize]; });
+        for (const auto &[name, stat]: sorted_results) {
+            fmt::print("{:>25}: {:.2f}MB -> {:.3f} ms \n", name, (double)
+                                                                     stat[Records::filesize] / (1024 * 1024),
+                       ns_to_ms(stat[Records::decompression]));
+        }
+    }
+
+    void print_sample_stats(const exrprofile::SampleLog & samples, const Records record, const std::string & title) {
+        fmt::print("\n{} per repetition:\n", title);
+        for (const auto &[name, records]: samples) {
+            if (records[record].empty()) continue;
+            fmt::print("{:>25}: ", name);
+            std::cout << StatsSummary<long>::compute(records[record], true);
+        }
+    }
+
+    int report_results(const Results & results, const SampleLog & samples, const RunInfo & run,
+                       const ReportOptions & report, const PerfLog & perf) {
+        try {
+            if (!report.json.empty()) {
+                write_json(report.json, results, samples, run, perf);
+                fmt::print("=== Results written to {}\n", report.json);
+            }
+            if (!report.csv.empty()) {
+                write_csv(report.csv, results, samples, run);
+                fmt::print("=== Results written to {}\n", report.csv);
+            }
+            if (report.baseline.empty())
+                return 0;
+
+            const auto baseline = read_json(report.baseline);
+            if (baseline.value("mode", "") != run.mode)
+                std::cerr << "Baseline was recorded in " << baseline.value("mode", "unknown") << " mode, this is "
+                          << run.mode << " mode." << std::endl;
+            const auto regressions = compare_to_baseline(baseline, results, samples, report.threshold, report.alpha);
+
+            fmt::print("\nCompared to {} (slowdown > {:.1f}%, p < {}):\n", report.baseline,
+                       100.0 * report.threshold, report.alpha);
+            size_t slower = 0;
+            for (const auto &r: regressions) {
+                slower += r.significant;
+                fmt::print("{:>25} {:>13}: {:.3f} ms -> {:.3f} ms ({:+.1f}%, p={:.4f}){}\n", r.name, record_name(r.record),
+                           ns_to_ms(r.baseline_mean), ns_to_ms(r.current_mean), 100.0 * (r.ratio - 1.0), r.p_value,
+                           r.significant ? "  <-- REGRESSION" : "");
+            }
+            fmt::print("=== {} regression(s) in {} comparisons\n", slower, regressions.size());
+            return slower > 0 ? 2 : 0;
+        } catch (const std::exception &e) {
+            std::cerr << "Error reporting results: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    long median_of(const Samples & samples) {
+        return samples.empty() ? 0 : deref(StatsSummary<long>::compute(samples, true).median);
+    }
+
+} // end of namespace exrprofile
@@ -0,0 +1,69 @@
+//
+// Created by symek on 5/3/25.
+//
+#pragma once
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+#include "exrprofile.h"
+#include "perfcount.h"
+
+namespace exrprofile {
+
+    const char *record_name(Records record);
+
+    // What produced a set of results: mode, command line configuration and the machine it ran on.
+    struct RunInfo {
+        std::string mode;                   // "read" or "compression"
+        nlohmann::json config = nlohmann::json::object();
+    };
+
+    nlohmann::json host_info();
+
+    // Full results with every sample, the format --compare reads back. Performance counters (--perf)
+    // go under "counters", per entry and phase.
+    nlohmann::json results_to_json(const Results &results, const SampleLog &samples, const RunInfo &run,
+                                   const PerfLog &perf = {});
+    void write_json(const std::string &path, const Results &results, const SampleLog &samples, const RunInfo &run,
+                    const PerfLog &perf = {});
+    // Long format, one row per sample: name, record, repetition, value (ns), plus file size and run config.
+    void write_csv(const std::string &path, const Results &results, const SampleLog &samples, const RunInfo &run);
+
+    struct Regression {
+        std::string name;
+        Records record;
+        double baseline_mean = 0.0;     // ns
+        double current_mean = 0.0;      // ns
+        double ratio = 1.0;             // current / baseline
+        double p_value = 1.0;           // Welch's t-test, 1.0 when there are too few samples
+        bool significant = false;
+    };
+
+    // Per entry and timed record, flags slowdowns of more than `threshold` (0.05 = 5%) whose Welch's
+    // t-test p-value is below `alpha`. With fewer than two samples on either side only the threshold
+    // applies. Entries missing from either side are ignored.
+    std::vector<Regression> compare_to_baseline(const nlohmann::json &baseline, const Results &results,
+                                                const SampleLog &samples, double threshold, double alpha);
+    nlohmann::json read_json(const std::string &path);
+
+    // Where results go besides stdout
+    struct ReportOptions {
+        std::string json;
+        std::string csv;
+        std::string baseline;
+        double threshold = 0.05;
+        double alpha = 0.01;
+    };
+
+    // Writes the requested exports and compares against a baseline. Returns the process exit code:
+    // 2 if a significant slowdown was found, so nightly runs can gate on it.
+    int report_results(const Results &results, const SampleLog &samples, const RunInfo &run,
+                       const ReportOptions &report, const PerfLog &perf = {});
+
+    // Stdout sinks: entries sorted by compression, decompression time and size, and the distribution
+    // of the repetitions behind each entry, tail latency included.
+    void print_sorted_stats(const Results &results);
+    void print_sample_stats(const SampleLog &samples, Records record, const std::string &title);
+    long median_of(const Samples &samples);
+
+} // end of namespace exrprofile
@@ -0,0 +1,479 @@
+//
+// Created by symek on 7/19/25.
+//
+#include "scan.h"
+#include "stats.h"
+#include "timing.h"
+#include <OpenEXR/openexr.h>
+#include <OpenEXR/ImfCompression.h>
+#include <glob.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <fmt/core.h>
+
+namespace exrprofile {
+
+    namespace {
+
+        constexpr size_t queue_capacity = 4096;
+        constexpr size_t progress_every = 10000;
+
+        void check(const exr_result_t rv, const char *what) {
+            if (rv != EXR_ERR_SUCCESS)
+                throw std::runtime_error(fmt::format("{}: {}", what, exr_get_default_error_message(rv)));
+        }
+
+        // A broken file in a list of 200k is a line in the report, not a message per failed call.
+        void quiet_errors(exr_const_context_t, exr_result_t, const char *) {}
+
+        std::string codec_name(const exr_compression_t compression) {
+            // exr_compression_t and Imf::Compression share their values
+            std::string name;
+            Imf::getCompressionNameFromId(static_cast<Imf::Compression>(compression), name);
+            return name;
+        }
+
+        const char *storage_name(const exr_storage_t storage) {
+            switch (storage) {
+                case EXR_STORAGE_TILED: return "tiled";
+                case EXR_STORAGE_DEEP_SCANLINE: return "deep scanline";
+                case EXR_STORAGE_DEEP_TILED: return "deep tiled";
+                default: return "scanline";
+            }
+        }
+
+        size_t sample_size(const exr_pixel_type_t type) {
+            return type == EXR_PIXEL_HALF ? 2 : 4;
+        }
+
+        const char *sample_name(const exr_pixel_type_t type) {
+            switch (type) {
+                case EXR_PIXEL_HALF: return "half";
+                case EXR_PIXEL_FLOAT: return "float";
+                default: return "uint";
+            }
+        }
+
+        bool is_pattern(const std::string &path) {
+            return path.find_first_of("*?[") != std::string::npos;
+        }
+
+        bool is_exr(const std::filesystem::path &path) {
+            auto extension = path.extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(),
+                           [](const unsigned char c) { return std::tolower(c); });
+            return extension == ".exr";
+        }
+
+        // "shot/beauty.0101.exr" -> "shot/beauty.####.exr", the last number of the file name masked
+        std::string sequence_pattern(const std::string &filename) {
+            std::filesystem::path path(filename);
+            auto name = path.filename().string();
+            const auto end = name.find_last_of("0123456789");
+            if (end != std::string::npos) {
+                auto start = end;
+                while (start > 0 && std::isdigit(static_cast<unsigned char>(name[start - 1])))
+                    --start;
+                name.replace(start, end - start + 1, end - start + 1, '#');
+            }
+            return (path.parent_path() / name).string();
+        }
+
+        // Paths in, from the lister; scanned files out, to the caller. Bounded so a huge walk doesn't
+        // run ahead of the readers.
+        class PathQueue {
+        public:
+            void push(std::string &&path) {
+                std::unique_lock lock(mutex);
+                room.wait(lock, [&]() { return paths.size() < queue_capacity; });
+                paths.push_back(std::move(path));
+                ready.notify_one();
+            }
+            bool pop(std::string &path, size_t &index) {
+                std::unique_lock lock(mutex);
+                ready.wait(lock, [&]() { return !paths.empty() || closed; });
+                if (paths.empty())
+                    return false;
+                path = std::move(paths.front());
+                paths.pop_front();
+                index = taken++;
+                room.notify_one();
+                return true;
+            }
+            void close() {
+                std::scoped_lock lock(mutex);
+                closed = true;
+                ready.notify_all();
+            }
+
+        private:
+            std::mutex mutex;
+            std::condition_variable ready, room;
+            std::deque<std::string> paths;
+            size_t taken = 0;
+            bool closed = false;
+        };
+
+        // Offsets of all chunks of all parts, straight from the tables after the headers.
+        void scan_offset_tables(exr_const_context_t context, const int parts, FileScan &scan) {
+            std::vector<uint64_t> offsets;
+            uint64_t tables_end = 0;
+            const int fd = ::open(scan.filename.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error("Cannot open " + scan.filename);
+            for (int p = 0; p < parts; ++p) {
+                uint64_t table = 0;
+                int32_t count = 0;
+                check(exr_get_chunk_table_offset(context, p, &table), "chunk table");
+                check(exr_get_chunk_count(context, p, &count), "chunk count");
+                const size_t first = offsets.size();
+                offsets.resize(first + std::max(count, 0));
+                const auto bytes = static_cast<ssize_t>((offsets.size() - first) * sizeof(uint64_t));
+                // little endian in the file, as on every machine we read them on
+                if (::pread(fd, offsets.data() + first, bytes, static_cast<off_t>(table)) != bytes) {
+                    ::close(fd);
+                    throw std::runtime_error("Truncated chunk offset table");
+                }
+                tables_end = std::max<uint64_t>(tables_end, table + bytes);
+            }
+            ::close(fd);
+
+            scan.chunks = offsets.size();
+            const auto outside = std::remove_if(offsets.begin(), offsets.end(), [&](const uint64_t offset) {
+                return offset < tables_end || offset >= scan.file_bytes;
+            });
+            scan.bad_offsets = std::distance(outside, offsets.end());
+            offsets.erase(outside, offsets.end());
+            if (offsets.empty())
+                return;
+            std::sort(offsets.begin(), offsets.end());
+            offsets.push_back(scan.file_bytes);
+            scan.packed_bytes = scan.file_bytes - offsets.front();
+            for (size_t i = 0; i + 1 < offsets.size(); ++i)
+                scan.max_chunk_bytes = std::max(scan.max_chunk_bytes, offsets[i + 1] - offsets[i]);
+        }
+
+        struct Totals {
+            size_t files = 0;
+            size_t broken = 0;          // unreadable or incomplete
+            uint64_t file_bytes = 0;
+            uint64_t raw_bytes = 0;
+            long predicted_ns = 0;
+            size_t predicted = 0;       // files with a prediction
+            std::set<std::string> codecs, resolutions;
+
+            void add(const FileScan &scan) {
+                ++files;
+                if (!scan.readable() || scan.bad_offsets > 0) {
+                    ++broken;
+                    if (!scan.readable())
+                        return;
+                }
+                file_bytes += scan.file_bytes;
+                raw_bytes += scan.raw_bytes;
+                codecs.insert(scan.compression);
+                resolutions.insert(fmt::format("{}x{}", scan.width, scan.height));
+                if (scan.predicted_ns > 0) {
+                    predicted_ns += scan.predicted_ns;
+                    ++predicted;
+                }
+            }
+            double ratio() const { return file_bytes ? (double) raw_bytes / (double) file_bytes : 0.0; }
+            // per frame, from the predicted ones
+            double frame_ns() const { return predicted ? (double) predicted_ns / (double) predicted : 0.0; }
+        };
+
+        std::string join(const std::set<std::string> &items) {
+            std::string joined;
+            for (const auto &item: items)
+                joined += (joined.empty() ? "" : ",") + item;
+            return joined;
+        }
+
+        double gigabytes(const uint64_t bytes) {
+            return (double) bytes / (1024.0 * 1024.0 * 1024.0);
+        }
+    }
+
+    void stream_paths(const std::string &list, const std::vector<std::string> &inputs, const PathSink &sink) {
+        if (!list.empty()) {
+            std::ifstream file(list);
+            if (!file.is_open())
+                throw std::runtime_error("Could not open file list: " + list);
+            std::string line;
+            while (std::getline(file, line)) {
+                const auto first = line.find_first_not_of(" \t\r\n");
+                if (first == std::string::npos)
+                    continue;
+                const auto last = line.find_last_not_of(" \t\r\n");
+                sink(line.substr(first, last - first + 1));
+            }
+        }
+
+        for (const auto &input: inputs) {
+            std::error_code error;
+            if (std::filesystem::is_directory(input, error)) {
+                const auto walk_options = std::filesystem::directory_options::skip_permission_denied;
+                for (auto it = std::filesystem::recursive_directory_iterator(input, walk_options, error);
+                     it != std::filesystem::recursive_directory_iterator(); it.increment(error)) {
+                    if (error)
+                        break;
+                    if (it->is_regular_file(error) && is_exr(it->path()))
+                        sink(it->path().string());
+                }
+                if (error)
+                    std::cerr << "Error walking " << input << ": " << error.message() << std::endl;
+            } else if (is_pattern(input)) {
+                glob_t matches{};
+                if (::glob(input.c_str(), 0, nullptr, &matches) == 0)
+                    for (size_t i = 0; i < matches.gl_pathc; ++i)
+                        sink(matches.gl_pathv[i]);
+                else
+                    std::cerr << "Nothing matches " << input << std::endl;
+                ::globfree(&matches);
+            } else {
+                sink(std::string(input));
+            }
+        }
+    }
+
+    FileScan scan_file(const std::string &filename) {
+        FileScan scan;
+        scan.filename = filename;
+        exr_context_t context = nullptr;
+        try {
+            std::error_code error;
+            scan.file_bytes = std::filesystem::file_size(filename, error);
+            if (error)
+                throw std::runtime_error(error.message());
+
+            exr_context_initializer_t initializer = EXR_DEFAULT_CONTEXT_INITIALIZER;
+            initializer.error_handler_fn = quiet_errors;
+            check(exr_start_read(&context, filename.c_str(), &initializer), "exr_start_read");
+            check(exr_get_count(context, &scan.parts), "part count");
+
+            for (int p = 0; p < scan.parts; ++p) {
+                exr_storage_t storage;
+                exr_compression_t compression;
+                exr_attr_box2i_t dw;
+                const exr_attr_chlist_t *channels = nullptr;
+                check(exr_get_storage(context, p, &storage), "storage");
+                check(exr_get_compression(context, p, &compression), "compression");
+                check(exr_get_data_window(context, p, &dw), "data window");
+                check(exr_get_channels(context, p, &channels), "channels");
+                const int width = dw.max.x - dw.min.x + 1;
+                const int height = dw.max.y - dw.min.y + 1;
+
+                // Bytes of one full resolution line, subsampled channels counted at their share
+                uint64_t line_bytes = 0;
+                std::map<std::string, std::string> by_type;
+                for (int c = 0; c < channels->num_channels; ++c) {
+                    const auto &channel = channels->entries[c];
+                    line_bytes += sample_size(channel.pixel_type) * width
+                                  / std::max(channel.x_sampling, 1) / std::max(channel.y_sampling, 1);
+                    auto &names = by_type[sample_name(channel.pixel_type)];
+                    names += (names.empty() ? "" : ",") + std::string(channel.name.str);
+                }
+                const bool deep = storage == EXR_STORAGE_DEEP_SCANLINE || storage == EXR_STORAGE_DEEP_TILED;
+                if (!deep)
+                    scan.raw_bytes += line_bytes * height;
+                if (p > 0)
+                    continue;
+
+                scan.storage = storage_name(storage);
+                scan.compression = codec_name(compression);
+                scan.width = width;
+                scan.height = height;
+                for (const auto &[type, names]: by_type)
+                    scan.channels += (scan.channels.empty() ? "" : " ") + type + ": " + names;
+                if (storage == EXR_STORAGE_TILED || storage == EXR_STORAGE_DEEP_TILED) {
+                    uint32_t tile_x = 0, tile_y = 0;
+                    exr_tile_level_mode_t level_mode;
+                    exr_tile_round_mode_t round_mode;
+                    check(exr_get_tile_descriptor(context, p, &tile_x, &tile_y, &level_mode, &round_mode),
+                          "tile descriptor");
+                    scan.lines_per_chunk = static_cast<int>(tile_y);
+                    scan.block_bytes = width ? line_bytes * tile_x / width * tile_y : 0;
+                } else {
+                    check(exr_get_scanlines_per_chunk(context, p, &scan.lines_per_chunk), "scanlines per chunk");
+                    scan.block_bytes = line_bytes * scan.lines_per_chunk;
+                }
+            }
+            scan_offset_tables(context, scan.parts, scan);
+        } catch (const std::exception &e) {
+            scan.error = e.what();
+        }
+        if (context)
+            exr_finish(&context);
+        return scan;
+    }
+
+    std::vector<FileScan> scan_files(const std::string &list, const std::vector<std::string> &inputs,
+                                     const ScanOptions &options) {
+        const int jobs = options.jobs > 0 ? options.jobs
+                                          : 4 * static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+        PathQueue queue;
+        std::mutex mutex;
+        std::vector<FileScan> scans;
+        std::atomic<size_t> done{0};
+        const auto start = Clock::now();
+
+        std::vector<std::thread> readers;
+        for (int i = 0; i < jobs; ++i) {
+            readers.emplace_back([&]() {
+                std::string path;
+                size_t index;
+                while (queue.pop(path, index)) {
+                    auto scan = scan_file(path);
+                    scan.index = index;
+                    {
+                        std::scoped_lock lock(mutex);
+                        scans.push_back(std::move(scan));
+                    }
+                    const size_t count = ++done;
+                    if (count % progress_every == 0)
+                        fmt::print("{:>15}: {} files ({:.0f} files/s)\n", "scanned", count,
+                                   (double) count / std::max(ns_to_seconds(elapsed_ns(start)), 1e-9));
+                }
+            });
+        }
+
+        try {
+            stream_paths(list, inputs, [&](std::string &&path) { queue.push(std::move(path)); });
+        } catch (const std::exception &e) {
+            std::cerr << "Error listing files: " << e.what() << std::endl;
+        }
+        queue.close();
+        for (auto &reader: readers)
+            reader.join();
+
+        std::sort(scans.begin(), scans.end(), [](const FileScan &a, const FileScan &b) { return a.index < b.index; });
+        fmt::print("=== Scanned {} files in {:.3f} seconds on {} threads\n", scans.size(),
+                   ns_to_seconds(elapsed_ns(start)), jobs);
+        return scans;
+    }
+
+    void predict_read_cost(std::vector<FileScan> &scans, const ScanOptions &options, const FrameReader &reader) {
+        if (options.sample <= 0)
+            return;
+        std::map<std::string, std::vector<double>> rates;   // ns per raw byte, per codec
+        for (const auto &scan: scans) {
+            if (!scan.readable() || scan.bad_offsets > 0 || scan.raw_bytes == 0)
+                continue;
+            auto &rate = rates[scan.compression];
+            if (rate.size() >= static_cast<size_t>(options.sample))
+                continue;
+            try {
+                const Stats stats = reader(scan.filename);
+                rate.push_back((double) stats[Records::decompression] / (double) scan.raw_bytes);
+            } catch (const std::exception &e) {
+                std::cerr << "Error reading " << scan.filename << ": " << e.what() << std::endl;
+            }
+        }
+
+        std::map<std::string, double> median;
+        for (auto &[codec, rate]: rates) {
+            if (rate.empty())
+                continue;
+            std::sort(rate.begin(), rate.end());
+            median[codec] = rate[rate.size() / 2];
+            fmt::print("{:>15}: {:.1f} MB/s decoded (median of {} files)\n", codec,
+                       median[codec] > 0.0 ? 1e9 / median[codec] / (1024 * 1024) : 0.0, rate.size());
+        }
+        for (auto &scan: scans) {
+            const auto found = median.find(scan.compression);
+            if (found != median.end() && scan.readable())
+                scan.predicted_ns = static_cast<long>(found->second * (double) scan.raw_bytes);
+        }
+    }
+
+    void print_scan_report(const std::vector<FileScan> &scans, const double fps, const int threads) {
+        std::map<std::string, Totals> codecs;
+        std::map<std::string, Totals> sequences;
+        Totals all;
+        for (const auto &scan: scans) {
+            all.add(scan);
+            if (scan.readable())
+                codecs[scan.compression].add(scan);
+            sequences[sequence_pattern(scan.filename)].add(scan);
+        }
+
+        fmt::print("\nInventory by codec:\n");
+        for (const auto &[codec, totals]: codecs)
+            fmt::print("{:>15}: {:>7} files | {:>9.2f}GB on disk | {:>9.2f}GB raw | ratio {:.2f} | "
+                       "predicted {:.1f} ms per frame\n", codec, totals.files, gigabytes(totals.file_bytes),
+                       gigabytes(totals.raw_bytes), totals.ratio(), totals.frame_ns() / 1e6);
+
+        // Biggest first, that's where re-encoding pays
+        std::vector<std::pair<std::string, Totals>> sorted(sequences.begin(), sequences.end());
+        std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+            return a.second.file_bytes > b.second.file_bytes;
+        });
+        const double frame_budget_ns = fps > 0.0 ? 1e9 / fps : 0.0;
+        size_t flagged = 0;
+        fmt::print("\nSequences:\n");
+        for (const auto &[pattern, totals]: sorted) {
+            std::vector<std::string> reasons;
+            if (frame_budget_ns > 0.0 && totals.frame_ns() > frame_budget_ns)
+                reasons.push_back(fmt::format("slower than {:g} fps", fps));
+            if (totals.codecs.size() > 1)
+                reasons.emplace_back("mixed codecs");
+            if (totals.resolutions.size() > 1)
+                reasons.emplace_back("mixed resolutions");
+            if (totals.codecs.count(codec_name(EXR_COMPRESSION_NONE)))
+                reasons.emplace_back("uncompressed");
+            if (totals.broken)
+                reasons.push_back(fmt::format("{} broken frames", totals.broken));
+            flagged += !reasons.empty();
+
+            std::string flags;
+            for (const auto &reason: reasons)
+                flags += (flags.empty() ? "  <-- " : ", ") + reason;
+            fmt::print("{} ({} frames): {} {} | {:.2f}GB | {:.1f} ms per frame{}\n", pattern, totals.files,
+                       join(totals.codecs), join(totals.resolutions), gigabytes(totals.file_bytes),
+                       totals.frame_ns() / 1e6, flags);
+        }
+
+        fmt::print("\n=== {} files in {} sequences, {:.2f}GB on disk, {:.2f}GB raw, {} broken, {} sequences to "
+                   "look at\n", all.files, sequences.size(), gigabytes(all.file_bytes), gigabytes(all.raw_bytes),
+                   all.broken, flagged);
+        if (all.predicted)
+            fmt::print("=== Predicted read time of {} of {} files: {:.2f} hours (one frame at a time, {} threads "
+                       "each)\n", all.predicted, all.files, ns_to_seconds((double) all.predicted_ns) / 3600.0,
+                       threads);
+    }
+
+    void write_scan_csv(const std::string &path, const std::vector<FileScan> &scans) {
+        std::ofstream out(path);
+        if (!out)
+            throw std::runtime_error("Cannot write " + path);
+        out << "filename,file_bytes,parts,storage,compression,width,height,channels,lines_per_chunk,chunks,"
+               "block_bytes,raw_bytes,packed_bytes,max_chunk_bytes,bad_offsets,predicted_ns,error\n";
+        // names and errors may hold commas
+        auto quoted = [](std::string text) {
+            for (size_t at = text.find('"'); at != std::string::npos; at = text.find('"', at + 2))
+                text.insert(at, 1, '"');
+            return '"' + text + '"';
+        };
+        for (const auto &s: scans)
+            out << quoted(s.filename) << ',' << s.file_bytes << ',' << s.parts << ',' << s.storage << ','
+                << quoted(s.compression) << ',' << s.width << ',' << s.height << ',' << quoted(s.channels) << ','
+                << s.lines_per_chunk << ',' << s.chunks << ',' << s.block_bytes << ',' << s.raw_bytes << ','
+                << s.packed_bytes << ',' << s.max_chunk_bytes << ',' << s.bad_offsets << ',' << s.predicted_ns
+                << ',' << quoted(s.error) << '\n';
+    }
+
+} // end of namespace exrprofile
@@ -0,0 +1,65 @@
+//
+// Created by symek on 7/19/25.
+//
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "mtread.h"
+
+namespace exrprofile {
+
+    struct ScanOptions {
+        int jobs = 0;           // header readers, 0: four per core, they mostly wait for the disk
+        int sample = 2;         // files per codec decoded to calibrate predicted read costs, 0 none
+        std::string csv;        // every file as a CSV row
+    };
+
+    // One file as its headers and chunk offset tables describe it, nothing decoded. Windows, channels
+    // and chunk geometry are those of the first part, counts and sizes cover all parts.
+    struct FileScan {
+        std::string filename;
+        size_t index = 0;               // position in the input stream
+        std::string error;              // why the headers couldn't be read, empty if they could
+        uint64_t file_bytes = 0;
+        int parts = 0;
+        std::string storage;            // scanline, tiled, deep scanline, deep tiled
+        std::string compression;
+        int width = 0, height = 0;
+        std::string channels;           // "half: A,B,G,R float: Z"
+        int lines_per_chunk = 0;        // tile height of tiled parts
+        uint64_t chunks = 0;
+        uint64_t block_bytes = 0;       // raw bytes of one scanline block or tile
+        uint64_t raw_bytes = 0;         // decoded size, level 0 of tiled parts, deep parts not counted
+        uint64_t packed_bytes = 0;      // from the first chunk to the end of the file
+        uint64_t max_chunk_bytes = 0;
+        uint64_t bad_offsets = 0;       // offset table entries pointing outside the file: incomplete frame
+        long predicted_ns = 0;          // read cost from the codec's calibration, 0 without one
+
+        bool readable() const { return error.empty(); }
+    };
+
+    // Paths from a list file (line by line, never loaded whole), directories (walked for *.exr) and
+    // glob patterns, handed to `sink` as they are found.
+    using PathSink = std::function<void(std::string &&path)>;
+    void stream_paths(const std::string &list, const std::vector<std::string> &inputs, const PathSink &sink);
+
+    // Headers and offset tables through the OpenEXR Core API, errors end up in FileScan::error.
+    FileScan scan_file(const std::string &filename);
+
+    // Scans all paths on options.jobs threads while they are still being listed, in input order.
+    std::vector<FileScan> scan_files(const std::string &list, const std::vector<std::string> &inputs,
+                                     const ScanOptions &options);
+
+    // Reads the first options.sample files of every codec with `reader` and predicts the read cost of
+    // all the others from their raw size at the median ns per raw byte of their codec.
+    void predict_read_cost(std::vector<FileScan> &scans, const ScanOptions &options, const FrameReader &reader);
+
+    // Totals per codec and per sequence (frame numbers masked), flagging sequences worth re-encoding:
+    // predicted slower than `fps`, mixed codecs or resolutions, uncompressed or incomplete frames.
+    // `threads` is what predict_read_cost() read the samples with.
+    void print_scan_report(const std::vector<FileScan> &scans, double fps, int threads);
+    void write_scan_csv(const std::string &path, const std::vector<FileScan> &scans);
+
+} // end of namespace exrprofile
@@ -5,8 +5,12 @@
 #include <vector>
 #include <numeric>
 #include <algorithm>
+#include <array>
 #include <cmath>
+#include <limits>
 #include <optional>
+#include <ostream>
+#include <fmt/core.h>
 
 namespace exrprofile {
 
@@ -15,6 +19,84 @@ namespace exrprofile {
         return *it;
     }
 
+    // P-square quantile estimator (Jain & Chlamtac, 1985): tracks one quantile with five markers,
+    // so it needs neither the samples nor a sort. Exact until the fifth sample.
+    class P2Quantile {
+    public:
+        explicit P2Quantile(double p) : p(p),
+                                        increments{0.0, p / 2, p, (1 + p) / 2, 1.0} {}
+
+        void add(double x) {
+            if (count < 5) {
+                heights[count++] = x;
+                std::sort(heights.begin(), heights.begin() + count);
+                if (count == 5) {
+                    positions = {1, 2, 3, 4, 5};
+                    desired = {1, 1 + 2 * p, 1 + 4 * p, 3 + 2 * p, 5};
+                }
+                return;
+            }
+            ++count;
+
+            // cell the sample falls into, extremes move with it
+            int k;
+            if (x < heights[0]) {
+                heights[0] = x;
+                k = 0;
+            } else if (x >= heights[4]) {
+                heights[4] = x;
+                k = 3;
+            } else {
+                k = 0;
+                while (x >= heights[k + 1]) ++k;
+            }
+            for (int i = k + 1; i < 5; ++i) positions[i] += 1;
+            for (int i = 0; i < 5; ++i) desired[i] += increments[i];
+
+            // nudge the middle markers towards where they should be
+            for (int i = 1; i < 4; ++i) {
+                const double d = desired[i] - positions[i];
+                if ((d >= 1 && positions[i + 1] - positions[i] > 1) || (d <= -1 && positions[i - 1] - positions[i] < -1)) {
+                    const int s = d > 0 ? 1 : -1;
+                    const double q = parabolic(i, s);
+                    heights[i] = (heights[i - 1] < q && q < heights[i + 1]) ? q : linear(i, s);
+                    positions[i] += s;
+                }
+            }
+        }
+
+        double value() const {
+            if (count == 0) return 0.0;
+            if (count < 5) {   // exact, nearest rank on the few samples we have
+                const auto rank = static_cast<size_t>(std::ceil(p * count));
+                return heights[std::clamp<size_t>(rank, 1, count) - 1];
+            }
+            return heights[2];
+        }
+
+    private:
+        double parabolic(int i, int d) const {
+            return heights[i] + d / (positions[i + 1] - positions[i - 1]) *
+                                ((positions[i] - positions[i - 1] + d) * (heights[i + 1] - heights[i]) /
+                                 (positions[i + 1] - positions[i]) +
+                                 (positions[i + 1] - positions[i] - d) * (heights[i] - heights[i - 1]) /
+                                 (positions[i] - positions[i - 1]));
+        }
+
+        double linear(int i, int d) const {
+            return heights[i] + d * (heights[i + d] - heights[i]) / (positions[i + d] - positions[i]);
+        }
+
+        double p;
+        size_t count = 0;
+        std::array<double, 5> heights{};
+        std::array<double, 5> positions{};
+        std::array<double, 5> desired{};
+        std::array<double, 5> increments;
+    };
+
+    // Single pass summary: samples are pushed one by one (Welford mean/variance, P-square tails),
+    // nothing is copied or sorted. Values are nanoseconds, printed as milliseconds.
     template<typename T>
     struct StatsSummary {
         size_t count = 0;
@@ -23,48 +105,54 @@ namespace exrprofile {
         double mean = 0.0;
         double stdev = 0.0;
         std::optional<T> median = std::nullopt;
+        double p90 = 0.0;
+        double p99 = 0.0;
+        double p999 = 0.0;
 
-        static StatsSummary compute(const std::vector<T> &data, bool compute_median = false) {
-            StatsSummary result;
-            if (data.empty()) return result;
-
-            result.count = data.size();
-            result.min = deref(std::min_element(data.begin(), data.end()));
-            result.max = deref(std::max_element(data.begin(), data.end()));
-
-            double sum = std::accumulate(data.begin(), data.end(), 0.0);
-            result.mean = sum / result.count;
-
-            // compute standard deviation
-            double variance = std::accumulate(
-                    data.begin(), data.end(), 0.0,
-                    [&](double acc, T x) {
-                        double diff = x - result.mean;
-                        return acc + diff * diff;
-                    }) / result.count;
-
-            result.stdev = std::sqrt(variance);
-
-            if (compute_median) {
-                std::vector<T> sorted = data;
-                std::sort(sorted.begin(), sorted.end());
-                if (result.count % 2 == 0)
-                    result.median = (sorted[result.count / 2 - 1] + sorted[result.count / 2]) / static_cast<T>(2);
-                else
-                    result.median = sorted[result.count / 2];
+        void add(T x) {
+            if (count == 0) {
+                min = max = x;
+            } else {
+                min = std::min(min, x);
+                max = std::max(max, x);
             }
+            ++count;
+            const double delta = static_cast<double>(x) - mean;
+            mean += delta / static_cast<double>(count);
+            m2 += delta * (static_cast<double>(x) - mean);
+            stdev = std::sqrt(m2 / static_cast<double>(count));
 
+            for (auto &q: quantiles) q.add(static_cast<double>(x));
+            median = static_cast<T>(quantiles[0].value());
+            p90 = quantiles[1].value();
+            p99 = quantiles[2].value();
+            p999 = quantiles[3].value();
+        }
+
+        static StatsSummary compute(const std::vector<T> &data, bool compute_median = false) {
+            StatsSummary result;
+            for (const auto &x: data)
+                result.add(x);
+            if (!compute_median)
+                result.median = std::nullopt;
             return result;
         }
         //  Stream output operator using fmt
        static std::string header()  {
-            return fmt::format("Count (files) -- Min -- Max -- Mean -- Stdev -- Median\n");
+            return fmt::format("Count (files) -- Min -- Max -- Mean -- Stdev -- Median -- p90 -- p99 -- p99.9\n");
         }
     friend std::ostream& operator<<(std::ostream& os, const StatsSummary& s) {
-        os << fmt::format("Files: {} | Min: {}ms | Max: {}ms | Mean: {:.4f}ms | Stdev: {:.4f}ms | Median: {}ms\n", s.count,  s.min, s.max, s.mean, s.stdev, *s.median);
+        constexpr double ms = 1e6;
+        os << fmt::format("Files: {} | Min: {:.3f}ms | Max: {:.3f}ms | Mean: {:.4f}ms | Stdev: {:.4f}ms | Median: {:.3f}ms"
+                          " | p90: {:.3f}ms | p99: {:.3f}ms | p99.9: {:.3f}ms\n",
+                          s.count, s.min / ms, s.max / ms, s.mean / ms, s.stdev / ms,
+                          s.median.value_or(T{}) / ms, s.p90 / ms, s.p99 / ms, s.p999 / ms);
         return os;
     }
+
+    private:
+        double m2 = 0.0;
+        std::array<P2Quantile, 4> quantiles{P2Quantile(0.5), P2Quantile(0.9), P2Quantile(0.99), P2Quantile(0.999)};
     };
 
 } // end of namespace exrprofile
-
@@ -0,0 +1,231 @@
+//
+// Created by symek on 4/12/25.
+//
+#include "streams.h"
+#include <OpenEXR/Iex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+
+namespace exrprofile {
+
+    namespace {
+        int open_readonly(const std::string &filename, uint64_t &size) {
+            const int fd = ::open(filename.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw Iex::InputExc("Cannot open " + filename + ": " + std::strerror(errno));
+            struct stat st{};
+            if (::fstat(fd, &st) != 0) {
+                ::close(fd);
+                throw Iex::InputExc("Cannot stat " + filename + ": " + std::strerror(errno));
+            }
+            size = static_cast<uint64_t>(st.st_size);
+            return fd;
+        }
+
+        // Reads until `n` bytes or the end of file, returns how many it got.
+        uint64_t pread_fully(const int fd, char *c, const uint64_t n, const uint64_t offset) {
+            uint64_t done = 0;
+            while (done < n) {
+                const ssize_t got = ::pread(fd, c + done, n - done, static_cast<off_t>(offset + done));
+                if (got < 0) {
+                    if (errno == EINTR) continue;
+                    throw Iex::InputExc(std::string{"Error reading file: "} + std::strerror(errno));
+                }
+                if (got == 0)
+                    break;
+                done += got;
+            }
+            return done;
+        }
+    }
+
+    MemoryIStream::MemoryIStream(const std::string &filename, const char *data, uint64_t size)
+            : Imf::IStream(filename.c_str()), data(data), size(size) {}
+
+    bool MemoryIStream::read(char c[], int n) {
+        if (position + n > size)
+            throw Iex::InputExc("Unexpected end of file.");
+        std::memcpy(c, data + position, n);
+        position += n;
+        return position < size;
+    }
+
+    char *MemoryIStream::readMemoryMapped(int n) {
+        if (position + n > size)
+            throw Iex::InputExc("Unexpected end of file.");
+        // OpenEXR wants a non-const pointer, but never writes through it.
+        char *chunk = const_cast<char *>(data + position);
+        position += n;
+        return chunk;
+    }
+
+    void MemoryIStream::seekg(uint64_t pos) {
+        if (pos > size)
+            throw Iex::InputExc("Seek past end of file.");
+        position = pos;
+    }
+
+#ifdef EXRPROFILE_STATELESS_READ
+    int64_t MemoryIStream::read(void *buf, uint64_t sz, uint64_t offset) {
+        if (offset >= size)
+            return 0;
+        const uint64_t n = std::min(sz, size - offset);
+        std::memcpy(buf, data + offset, n);
+        return static_cast<int64_t>(n);
+    }
+#endif
+
+    MmapIStream::MmapIStream(const std::string &filename) : MemoryIStream(filename, nullptr, 0) {
+        const int fd = open_readonly(filename, size);
+        if (size > 0) {
+            void *mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                ::close(fd);
+                throw Iex::InputExc("Cannot mmap " + filename + ": " + std::strerror(errno));
+            }
+            data = static_cast<const char *>(mapped);
+        }
+        ::close(fd); // mapping keeps its own reference
+    }
+
+    MmapIStream::~MmapIStream() {
+        if (data)
+            ::munmap(const_cast<char *>(data), size);
+    }
+
+    PreadIStream::PreadIStream(const std::string &filename) : Imf::IStream(filename.c_str()) {
+        fd = open_readonly(filename, size);
+    }
+
+    PreadIStream::~PreadIStream() {
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    bool PreadIStream::read(char c[], int n) {
+        if (position + n > size || pread_fully(fd, c, n, position) < static_cast<uint64_t>(n))
+            throw Iex::InputExc("Unexpected end of file.");
+        position += n;
+        return position < size;
+    }
+
+#ifdef EXRPROFILE_STATELESS_READ
+    int64_t PreadIStream::read(void *buf, uint64_t sz, uint64_t offset) {
+        return static_cast<int64_t>(pread_fully(fd, static_cast<char *>(buf), sz, offset));
+    }
+#endif
+
+    MemoryOStream::MemoryOStream(const std::string &name) : Imf::OStream(name.c_str()) {}
+
+    void MemoryOStream::write(const char c[], int n) {
+        const uint64_t end = position + n;
+        if (end > bytes.size())
+            bytes.resize(end);
+        std::memcpy(bytes.data() + position, c, n);
+        position = end;
+        length = std::max(length, end);
+    }
+
+    void sync_file(const std::string &filename) {
+        auto sync = [](const std::string &path, const int flags) {
+            const int fd = ::open(path.c_str(), flags);
+            if (fd < 0)
+                throw Iex::IoExc("Cannot open " + path + ": " + std::strerror(errno));
+            const int result = ::fsync(fd);
+            const int error = errno;
+            ::close(fd);
+            if (result != 0)
+                throw Iex::IoExc("Cannot fsync " + path + ": " + std::strerror(error));
+        };
+        sync(filename, O_WRONLY);
+        const auto directory = std::filesystem::absolute(filename).parent_path();
+        sync(directory.string(), O_RDONLY | O_DIRECTORY);
+    }
+
+    std::unique_ptr<Imf::IStream> open_istream(const std::string &filename, StreamBackend backend) {
+        switch (backend) {
+            case StreamBackend::mmap:
+                return std::make_unique<MmapIStream>(filename);
+            case StreamBackend::pread:
+                return std::make_unique<PreadIStream>(filename);
+            case StreamBackend::stdio:
+            default:
+                return std::make_unique<Imf::StdIFStream>(filename.c_str());
+        }
+    }
+
+    const char *backend_name(StreamBackend backend) {
+        switch (backend) {
+            case StreamBackend::mmap: return "mmap";
+            case StreamBackend::pread: return "pread";
+            default: return "stdio";
+        }
+    }
+
+    const char *cache_mode_name(CacheMode mode) {
+        switch (mode) {
+            case CacheMode::warm: return "warm";
+            case CacheMode::cold: return "cold";
+            case CacheMode::direct: return "direct";
+            default: return "none";
+        }
+    }
+
+    bool evict_file(const std::string &filename) {
+        const int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        // Dirty pages can't be dropped, so freshly written files have to hit the disk first.
+        ::fdatasync(fd);
+        const bool evicted = ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+        ::close(fd);
+        return evicted;
+    }
+
+    StagedFile stage_file(const std::string &filename, bool direct) {
+        constexpr uint64_t alignment = 4096;
+        StagedFile staged;
+
+        int fd = direct ? ::open(filename.c_str(), O_RDONLY | O_DIRECT) : -1;
+        if (direct && fd < 0)
+            throw Iex::InputExc("Cannot open " + filename + " with O_DIRECT: " + std::strerror(errno));
+        if (fd >= 0) {
+            struct stat st{};
+            ::fstat(fd, &st);
+            staged.size = static_cast<uint64_t>(st.st_size);
+        } else {
+            fd = open_readonly(filename, staged.size);
+        }
+
+        // O_DIRECT wants aligned offsets, lengths and buffer, so round the request up to whole blocks.
+        const uint64_t capacity = std::max<uint64_t>((staged.size + alignment - 1) / alignment * alignment, alignment);
+        staged.bytes.reset(static_cast<char *>(std::aligned_alloc(alignment, capacity)));
+        if (!staged.bytes) {
+            ::close(fd);
+            throw std::bad_alloc();
+        }
+
+        uint64_t done = 0;
+        while (done < staged.size) {
+            const ssize_t got = ::pread(fd, staged.bytes.get() + done, capacity - done, static_cast<off_t>(done));
+            if (got < 0) {
+                if (errno == EINTR) continue;
+                ::close(fd);
+                throw Iex::InputExc("Error staging " + filename + ": " + std::strerror(errno));
+            }
+            if (got == 0) break;
+            done += got;
+        }
+        ::close(fd);
+        if (done < staged.size)
+            throw Iex::InputExc("Unexpected end of file while staging " + filename);
+        return staged;
+    }
+
+} // end of namespace exrprofile
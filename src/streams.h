@@ -0,0 +1,130 @@
+//
+// Created by symek on 4/12/25.
+//
+#pragma once
+#include <OpenEXR/ImfIO.h>
+#include <OpenEXR/ImfStdIO.h>
+#include <OpenEXR/OpenEXRConfig.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+
+// OpenEXR 3.3 moved the C++ readers on top of the Core library. They no longer call readMemoryMapped(),
+// they read through IStream::read(buf, size, offset) from many threads at once if the stream says it
+// can (isStatelessRead), otherwise they serialize seekg() + read() behind a lock.
+#if OPENEXR_VERSION_MAJOR > 3 || (OPENEXR_VERSION_MAJOR == 3 && OPENEXR_VERSION_MINOR >= 3)
+#define EXRPROFILE_STATELESS_READ 1
+#endif
+
+namespace exrprofile {
+
+    // How bytes get from the file into OpenEXR
+    enum class StreamBackend {
+        stdio,  // OpenEXR's own std::ifstream based stream (copies through a userspace buffer)
+        mmap,   // whole file mapped, chunks handed out zero-copy via readMemoryMapped() (before 3.3),
+                // copied out of the mapping by concurrent stateless reads (3.3 and later)
+        pread   // plain pread(2) per request, no stream buffering, concurrent from 3.3
+    };
+
+    // Read-only stream over bytes someone else owns. Reports itself as memory mapped,
+    // so OpenEXR takes chunk data by pointer instead of copying it.
+    class MemoryIStream : public Imf::IStream {
+    public:
+        MemoryIStream(const std::string &filename, const char *data, uint64_t size);
+
+        bool isMemoryMapped() const override { return true; }
+        bool read(char c[], int n) override;
+        char *readMemoryMapped(int n) override;
+        uint64_t tellg() override { return position; }
+        void seekg(uint64_t pos) override;
+#ifdef EXRPROFILE_STATELESS_READ
+        bool isStatelessRead() const override { return true; }
+        int64_t read(void *buf, uint64_t sz, uint64_t offset) override;
+#endif
+
+    protected:
+        const char *data = nullptr;
+        uint64_t size = 0;
+        uint64_t position = 0;
+    };
+
+    // mmap(2) of the whole file, unmapped on destruction.
+    class MmapIStream : public MemoryIStream {
+    public:
+        explicit MmapIStream(const std::string &filename);
+        ~MmapIStream() override;
+        MmapIStream(const MmapIStream &) = delete;
+        MmapIStream &operator=(const MmapIStream &) = delete;
+    };
+
+    // Unbuffered positional reads, one syscall per OpenEXR request. With OpenEXR 3.3 and later the
+    // requests don't share a file position, so decoding threads read side by side.
+    class PreadIStream : public Imf::IStream {
+    public:
+        explicit PreadIStream(const std::string &filename);
+        ~PreadIStream() override;
+        PreadIStream(const PreadIStream &) = delete;
+        PreadIStream &operator=(const PreadIStream &) = delete;
+
+        bool read(char c[], int n) override;
+        uint64_t tellg() override { return position; }
+        void seekg(uint64_t pos) override { position = pos; }
+#ifdef EXRPROFILE_STATELESS_READ
+        bool isStatelessRead() const override { return true; }
+        int64_t read(void *buf, uint64_t sz, uint64_t offset) override;
+#endif
+
+    private:
+        int fd = -1;
+        uint64_t size = 0;
+        uint64_t position = 0;
+    };
+
+    // Write stream into a growable buffer. clear() keeps the allocation, so repeated encodes
+    // of the same frame don't pay for growing (and faulting in) the buffer again.
+    class MemoryOStream : public Imf::OStream {
+    public:
+        explicit MemoryOStream(const std::string &name = "memory");
+
+        void write(const char c[], int n) override;
+        uint64_t tellp() override { return position; }
+        void seekp(uint64_t pos) override { position = pos; }
+
+        void clear() { position = length = 0; }
+        const char *data() const { return bytes.data(); }
+        uint64_t size() const { return length; }
+
+    private:
+        std::vector<char> bytes;
+        uint64_t position = 0;
+        uint64_t length = 0;
+    };
+
+    // fsync(2) of a written file and of its directory, so a new file is really on the disk.
+    void sync_file(const std::string &filename);
+
+    std::unique_ptr<Imf::IStream> open_istream(const std::string &filename, StreamBackend backend);
+    const char *backend_name(StreamBackend backend);
+
+    // Whether a frame is pulled into memory before decoding, and from where
+    enum class CacheMode {
+        none,   // decode straight from the stream backend (I/O and decode are mixed)
+        warm,   // stage whole file into memory first, whatever is in the page cache stays there
+        cold,   // drop the file from the page cache (posix_fadvise DONTNEED), then stage it
+        direct  // stage with O_DIRECT, bypassing the page cache altogether
+    };
+    const char *cache_mode_name(CacheMode mode);
+
+    // Whole file in memory. Buffer is page aligned so it can be the target of O_DIRECT reads.
+    struct StagedFile {
+        std::unique_ptr<char, void (*)(void *)> bytes{nullptr, std::free};
+        uint64_t size = 0;
+    };
+
+    // Flushes and drops cached pages of a file. Best effort, returns false if the kernel refused.
+    bool evict_file(const std::string &filename);
+    StagedFile stage_file(const std::string &filename, bool direct);
+
+} // end of namespace exrprofile
@@ -0,0 +1,233 @@
+//
+// Created by symek on 5/31/25.
+//
+#include "synthetic.h"
+#include <Imath/half.h>
+#include <algorithm>
+#include <cmath>
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+namespace exrprofile {
+
+    namespace {
+
+        // Counter layout: {x, y, stream, octave}, the seed is the key.
+        enum Stream : uint32_t { grain = 0, lattice = 1, objects = 2 };
+
+        constexpr int band_rows = 16;
+
+        float smooth(const float t) { return t * t * (3.0f - 2.0f * t); }
+
+        class Generator {
+        public:
+            Generator(const int width, const int height, const Content content, const uint64_t seed)
+                    : width(width), height(height), content(content),
+                      key{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)} {}
+
+            // 4 floats (r, g, b, a) per pixel
+            void row(const int y, float *out) const {
+                std::vector<NoiseRow> noise;
+                if (content == Content::noisy)
+                    noise = noise_rows(y, 256.0f, 3);
+                else if (content == Content::texture)
+                    noise = noise_rows(y, 4.0f, 2);
+                for (int x = 0; x < width; ++x, out += 4)
+                    pixel(x, y, noise, out);
+            }
+
+        private:
+            Philox::Counter random(const int x, const int y, const Stream stream, const uint32_t octave = 0) const {
+                return Philox::generate({static_cast<uint32_t>(x), static_cast<uint32_t>(y), stream, octave}, key);
+            }
+
+            // Lattice values above and below a row for one octave of value noise, so a pixel only interpolates.
+            struct NoiseRow {
+                float scale = 1.0f;   // pixels per lattice cell
+                float ty = 0.0f;
+                float amplitude = 1.0f;
+                std::vector<float> top, bottom;
+            };
+
+            std::vector<NoiseRow> noise_rows(const int y, float scale, const int octaves) const {
+                std::vector<NoiseRow> rows(octaves);
+                float amplitude = 0.5f, total = 0.0f;
+                for (int octave = 0; octave < octaves; ++octave, scale *= 0.5f, amplitude *= 0.5f) {
+                    auto &row = rows[octave];
+                    row.scale = std::max(scale, 1.0f);
+                    row.amplitude = amplitude;
+                    total += amplitude;
+                    const float fy = static_cast<float>(y) / row.scale;
+                    const int cy = static_cast<int>(std::floor(fy));
+                    row.ty = smooth(fy - static_cast<float>(cy));
+                    const int cells = static_cast<int>(static_cast<float>(width) / row.scale) + 2;
+                    row.top.resize(cells);
+                    row.bottom.resize(cells);
+                    for (int cx = 0; cx < cells; ++cx) {
+                        row.top[cx] = to_unit(random(cx, cy, lattice, octave)[0]);
+                        row.bottom[cx] = to_unit(random(cx, cy + 1, lattice, octave)[0]);
+                    }
+                }
+                for (auto &row: rows)
+                    row.amplitude /= total;
+                return rows;
+            }
+
+            // Octaves of smoothly interpolated lattice noise, in [0, 1)
+            static float fbm(const std::vector<NoiseRow> &rows, const int x) {
+                float sum = 0.0f;
+                for (const auto &row: rows) {
+                    const float fx = static_cast<float>(x) / row.scale;
+                    const int cx = static_cast<int>(fx);
+                    const float tx = smooth(fx - static_cast<float>(cx));
+                    const float top = row.top[cx] * (1 - tx) + row.top[cx + 1] * tx;
+                    const float bottom = row.bottom[cx] * (1 - tx) + row.bottom[cx + 1] * tx;
+                    sum += row.amplitude * (top * (1 - row.ty) + bottom * row.ty);
+                }
+                return sum;
+            }
+
+            // Four normal deviates (Box-Muller) from one Philox block
+            std::array<float, 4> gaussian(const int x, const int y) const {
+                const auto bits = random(x, y, grain);
+                std::array<float, 4> normal{};
+                for (int i = 0; i < 4; i += 2) {
+                    const float radius = std::sqrt(-2.0f * std::log(1.0f - to_unit(bits[i])));
+                    const float angle = 6.2831853f * to_unit(bits[i + 1]);
+                    normal[i] = radius * std::cos(angle);
+                    normal[i + 1] = radius * std::sin(angle);
+                }
+                return normal;
+            }
+
+            void pixel(const int x, const int y, const std::vector<NoiseRow> &noise, float *rgba) const {
+                const float u = width > 1 ? static_cast<float>(x) / static_cast<float>(width - 1) : 0.0f;
+                const float v = height > 1 ? static_cast<float>(y) / static_cast<float>(height - 1) : 0.0f;
+                switch (content) {
+                    case Content::flat:
+                        rgba[0] = 0.18f, rgba[1] = 0.16f, rgba[2] = 0.14f, rgba[3] = 1.0f;
+                        return;
+
+                    case Content::gradient:
+                        rgba[0] = u, rgba[1] = v, rgba[2] = 1.0f - u * v, rgba[3] = 1.0f;
+                        return;
+
+                    case Content::texture: {
+                        const float detail = fbm(noise, x);
+                        const float checker = static_cast<float>(((x >> 1) + (y >> 1)) & 1);
+                        const float stripes = 0.5f + 0.5f * std::sin(0.9f * static_cast<float>(x) + 0.3f * static_cast<float>(y));
+                        const float white = to_unit(random(x, y, grain)[0]);
+                        rgba[0] = 0.5f * detail + 0.5f * stripes;
+                        rgba[1] = 0.3f * checker + 0.7f * detail;
+                        rgba[2] = 0.5f * white + 0.25f * stripes;
+                        rgba[3] = 1.0f;
+                        return;
+                    }
+
+                    case Content::alpha: {
+                        // at most one disc per 64 pixel cell, one cell in ten has one
+                        constexpr int cell = 64;
+                        const int cx = x / cell, cy = y / cell;
+                        const auto object = random(cx, cy, objects);
+                        rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0.0f;
+                        if (to_unit(object[0]) >= 0.1f)
+                            return;
+                        const float centre_x = static_cast<float>(cx * cell) + 16.0f + 32.0f * to_unit(object[1]);
+                        const float centre_y = static_cast<float>(cy * cell) + 16.0f + 32.0f * to_unit(object[2]);
+                        const float radius = 4.0f + 12.0f * to_unit(object[3]);
+                        const float distance = std::hypot(static_cast<float>(x) - centre_x, static_cast<float>(y) - centre_y);
+                        const float alpha = std::clamp(radius - distance + 0.5f, 0.0f, 1.0f);
+                        const auto colour = random(cx, cy, objects, 1);
+                        for (int c = 0; c < 3; ++c)
+                            rgba[c] = alpha * to_unit(colour[c]);
+                        rgba[3] = alpha;
+                        return;
+                    }
+
+                    case Content::depth: {
+                        // a tilted plane per 128 pixel cell, log distributed between 1 and 1000 units, some sky
+                        constexpr int cell = 128;
+                        const int cx = x / cell, cy = y / cell;
+                        const auto plane = random(cx, cy, objects);
+                        float z = 10000.0f;
+                        if (to_unit(plane[0]) < 0.85f) {
+                            const float dx = static_cast<float>(x - cx * cell), dy = static_cast<float>(y - cy * cell);
+                            const float base = std::exp(6.9077553f * to_unit(plane[1]));
+                            z = base * (1.0f + 0.002f * ((to_unit(plane[2]) - 0.5f) * dx + (to_unit(plane[3]) - 0.5f) * dy));
+                        }
+                        rgba[0] = rgba[1] = rgba[2] = z;
+                        rgba[3] = 1.0f;
+                        return;
+                    }
+
+                    default: {   // noisy render: soft shading, tinted, with grain that grows with brightness
+                        const float shading = 0.05f + 0.7f * fbm(noise, x) * (0.6f + 0.4f * (1.0f - v));
+                        const float base[3] = {shading * 1.1f, shading, shading * 0.8f + 0.05f * u};
+                        const auto noise = gaussian(x, y);
+                        for (int c = 0; c < 3; ++c)
+                            rgba[c] = std::max(base[c] + noise[c] * (0.01f + 0.05f * std::sqrt(base[c])), 0.0f);
+                        rgba[3] = 1.0f;
+                        return;
+                    }
+                }
+            }
+
+            int width;
+            int height;
+            Content content;
+            Philox::Key key;
+        };
+    }
+
+    const char *content_name(const Content content) {
+        switch (content) {
+            case Content::flat: return "flat";
+            case Content::gradient: return "gradient";
+            case Content::texture: return "texture";
+            case Content::alpha: return "alpha";
+            case Content::depth: return "depth";
+            default: return "noisy";
+        }
+    }
+
+    void float_to_half(const float *in, uint16_t *out, const size_t count) {
+        size_t i = 0;
+#ifdef __F16C__
+        for (; i + 8 <= count; i += 8) {
+            const __m128i halves = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), halves);
+        }
+#endif
+        for (; i < count; ++i)
+            out[i] = Imath::half(in[i]).bits();
+    }
+
+    std::vector<Imf::Rgba> generate_synthetic_pixels(const int width, const int height, const Content content,
+                                                     const uint64_t seed, ThreadPool &pool) {
+        std::vector<Imf::Rgba> pixels(static_cast<size_t>(width) * height);
+        const Generator generator(width, height, content, seed);
+
+        TaskGroup bands;
+        for (int y0 = 0; y0 < height; y0 += band_rows) {
+            pool.enqueue(bands, [&, y0]() {
+                std::vector<float> floats(static_cast<size_t>(width) * 4);
+                std::vector<uint16_t> halves(floats.size());
+                for (int y = y0; y < std::min(y0 + band_rows, height); ++y) {
+                    generator.row(y, floats.data());
+                    float_to_half(floats.data(), halves.data(), floats.size());
+                    Imf::Rgba *out = &pixels[static_cast<size_t>(y) * width];
+                    for (int x = 0; x < width; ++x) {
+                        out[x].r.setBits(halves[4 * x]);
+                        out[x].g.setBits(halves[4 * x + 1]);
+                        out[x].b.setBits(halves[4 * x + 2]);
+                        out[x].a.setBits(halves[4 * x + 3]);
+                    }
+                }
+            });
+        }
+        pool.wait(bands);
+        return pixels;
+    }
+
+} // end of namespace exrprofile
@@ -0,0 +1,58 @@
+//
+// Created by symek on 5/31/25.
+//
+#pragma once
+#include <OpenEXR/ImfRgba.h>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "threadpool.h"
+
+namespace exrprofile {
+
+    // What the test frames look like. Codecs rank very differently on each of these.
+    enum class Content {
+        flat,       // constant colour
+        gradient,   // smooth ramps
+        noisy,      // render with shading and luminance dependent grain (default)
+        texture,    // high frequency detail: checkers, stripes, fine noise
+        alpha,      // sparse premultiplied objects on an empty (0, 0, 0, 0) background
+        depth       // depth like: planes at a wide range of distances with hard edges
+    };
+    const char *content_name(Content content);
+
+    // Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3"): a counter based
+    // generator, the numbers for a counter depend on nothing else, so every pixel has its own stream
+    // and any thread can produce it in any order.
+    struct Philox {
+        using Counter = std::array<uint32_t, 4>;
+        using Key = std::array<uint32_t, 2>;
+
+        static Counter generate(Counter counter, Key key) {
+            for (int round = 0; round < 10; ++round) {
+                if (round > 0) {
+                    key[0] += 0x9E3779B9u;
+                    key[1] += 0xBB67AE85u;
+                }
+                const uint64_t product0 = uint64_t{0xD2511F53u} * counter[0];
+                const uint64_t product1 = uint64_t{0xCD9E8D57u} * counter[2];
+                counter = {static_cast<uint32_t>(product1 >> 32) ^ counter[1] ^ key[0], static_cast<uint32_t>(product1),
+                           static_cast<uint32_t>(product0 >> 32) ^ counter[3] ^ key[1], static_cast<uint32_t>(product0)};
+            }
+            return counter;
+        }
+    };
+
+    // [0, 1) from the top 24 bits
+    inline float to_unit(const uint32_t bits) {
+        return static_cast<float>(bits >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // Half bits of `count` floats, eight at a time with F16C when the build targets it.
+    void float_to_half(const float *in, uint16_t *out, size_t count);
+
+    // Same seed and content, same pixels, whatever the thread count. Rows are filled in bands on the pool.
+    std::vector<Imf::Rgba> generate_synthetic_pixels(int width, int height, Content content, uint64_t seed,
+                                                     ThreadPool &pool);
+
+} // end of namespace exrprofile
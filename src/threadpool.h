@@ -4,38 +4,55 @@
 // ThreadPool.h
 #pragma once
 #include <vector>
+#include <deque>
 #include <thread>
 #include <mutex>
-#include <queue>
+#include <memory>
 #include <condition_variable>
 #include <functional>
 #include <atomic>
+#include <iostream>
+#include <algorithm>
 
 namespace exrprofile {
 
+    // Counts tasks in flight, so a caller can wait for just its own batch (e.g. regions of one frame).
+    class TaskGroup {
+    public:
+        size_t pending() const { return counter.load(std::memory_order_acquire); }
 
+    private:
+        friend class ThreadPool;
+        std::atomic<size_t> counter{0};
+        std::atomic<size_t> queued{0};  // of those, still sitting in a deque
+    };
+
+    // Work-stealing pool: every worker owns a deque, pushes and pops its own work LIFO at the back and,
+    // when it runs dry, steals FIFO from the front of the others. Tasks enqueued from inside a task stay
+    // on the local deque, so a frame's regions are picked up by the thread that opened the frame first
+    // and by idle threads (of other, finished frames) second. Tasks are regions, so scheduling is as fine as
+    // the partition: chunk by chunk with Partition::dynamic, a stripe per task otherwise.
     class ThreadPool {
     public:
         explicit ThreadPool(size_t thread_count) : stop_flag(false) {
+            thread_count = std::max<size_t>(thread_count, 1);
+            for (size_t i = 0; i < thread_count; ++i)
+                queues.emplace_back(std::make_unique<WorkQueue>());
+
             for (size_t i = 0; i < thread_count; ++i) {
-                workers.emplace_back([this]() {
+                workers.emplace_back([this, i]() {
+                    current_pool = this;
+                    current_index = i;
                     while (true) {
-                        std::function<void()> task;
+                        if (run_one(i))
+                            continue;
 
-                        {   // lock scope
-                            std::unique_lock<std::mutex> lock(queue_mutex);
-                            condition.wait(lock, [this]() {
-                                return stop_flag || !tasks.empty();
-                            });
-
-                            if (stop_flag && tasks.empty())
-                                return;
-
-                            task = std::move(tasks.front());
-                            tasks.pop();
-                        }
-
-                        task(); // run the task
+                        std::unique_lock<std::mutex> lock(sleep_mutex);
+                        condition.wait(lock, [this]() {
+                            return stop_flag || queued.load(std::memory_order_acquire) > 0;
+                        });
+                        if (stop_flag && queued.load(std::memory_order_acquire) == 0)
+                            return;
                     }
                 });
             }
@@ -43,7 +60,7 @@ namespace exrprofile {
 
         ~ThreadPool() {
             {
-                std::scoped_lock lock(queue_mutex);
+                std::scoped_lock lock(sleep_mutex);
                 stop_flag = true;
             }
             condition.notify_all();
@@ -52,21 +69,131 @@ namespace exrprofile {
             }
         }
 
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        size_t size() const { return workers.size(); }
+
         template<typename Func>
         void enqueue(Func &&f) {
+            push(Task{std::function<void()>(std::forward<Func>(f)), nullptr});
+        }
+
+        template<typename Func>
+        void enqueue(TaskGroup &group, Func &&f) {
+            group.counter.fetch_add(1, std::memory_order_relaxed);
+            group.queued.fetch_add(1, std::memory_order_relaxed);
+            push(Task{[this, &group, task = std::forward<Func>(f)]() mutable {
+                run_guarded(task);
+                // The group may be gone as soon as it reads zero, only touch the pool after this.
+                if (group.counter.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    notify_waiters();
+            }, &group});
+            notify_waiters();   // a pool thread waiting on this group can take it
+        }
+
+        // Blocks until every task of the group finished. A pool thread helps with tasks of this group
+        // only, never with other frames' regions (their time would count as ours) and never with
+        // anything that could wait in turn. With none of ours left in the deques it sleeps, like
+        // an outside thread does.
+        void wait(TaskGroup &group) {
+            const bool inside = current_pool == this;
+            while (group.pending() > 0) {
+                if (inside && run_one(current_index, &group))
+                    continue;
+                std::unique_lock<std::mutex> lock(done_mutex);
+                done_condition.wait(lock, [&group, inside]() {
+                    return group.pending() == 0 || (inside && group.queued.load(std::memory_order_acquire) > 0);
+                });
+            }
+        }
+
+    private:
+        struct Task {
+            std::function<void()> run;
+            TaskGroup *group = nullptr;
+        };
+
+        struct alignas(64) WorkQueue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        void notify_waiters() {
+            { std::scoped_lock lock(done_mutex); }
+            done_condition.notify_all();
+        }
+
+        template<typename Task>
+        static void run_guarded(Task &task) {
+            try {
+                task();
+            } catch (const std::exception &e) {
+                std::cerr << "Error in pool task: " << e.what() << std::endl;
+            }
+        }
+
+        void push(Task task) {
+            // Workers keep their own spawns local, outside submitters are spread round-robin.
+            const size_t target = current_pool == this ? current_index
+                                                       : next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
             {
-                std::scoped_lock lock(queue_mutex);
-                tasks.emplace(std::forward<Func>(f));
+                std::scoped_lock lock(queues[target]->mutex);
+                queues[target]->tasks.push_back(std::move(task));
             }
+            queued.fetch_add(1, std::memory_order_release);
+            { std::scoped_lock lock(sleep_mutex); } // don't let a worker miss the wake up between check and wait
             condition.notify_one();
         }
 
-    private:
+        // With a group, only a task of that group is taken, wherever it sits in the deque.
+        bool pop(size_t index, Task &task, const TaskGroup *only = nullptr) {
+            for (size_t n = 0; n < queues.size(); ++n) {
+                const size_t victim = (index + n) % queues.size();
+                std::scoped_lock lock(queues[victim]->mutex);
+                auto &tasks = queues[victim]->tasks;
+                auto matches = [only](const Task &queued) { return !only || queued.group == only; };
+                if (n == 0) {   // own deque: newest first, it's still warm in cache
+                    const auto found = std::find_if(tasks.rbegin(), tasks.rend(), matches);
+                    if (found == tasks.rend())
+                        continue;
+                    task = std::move(*found);
+                    tasks.erase(std::next(found).base());
+                } else {        // someone else's: steal the oldest, biggest piece of work
+                    const auto found = std::find_if(tasks.begin(), tasks.end(), matches);
+                    if (found == tasks.end())
+                        continue;
+                    task = std::move(*found);
+                    tasks.erase(found);
+                }
+                if (task.group)
+                    task.group->queued.fetch_sub(1, std::memory_order_acq_rel);
+                queued.fetch_sub(1, std::memory_order_acq_rel);
+                return true;
+            }
+            return false;
+        }
+
+        bool run_one(size_t index, const TaskGroup *only = nullptr) {
+            Task task;
+            if (!pop(index, task, only))
+                return false;
+            run_guarded(task.run);
+            return true;
+        }
+
+        std::vector<std::unique_ptr<WorkQueue>> queues;
         std::vector<std::thread> workers;
-        std::queue<std::function<void()>> tasks;
 
-        std::mutex queue_mutex;
+        std::atomic<size_t> queued{0};
+        std::atomic<size_t> next_queue{0};
+        std::mutex sleep_mutex;
         std::condition_variable condition;
+        std::mutex done_mutex;
+        std::condition_variable done_condition;
         std::atomic<bool> stop_flag;
+
+        inline static thread_local ThreadPool *current_pool = nullptr;
+        inline static thread_local size_t current_index = 0;
     };
-} // end of namespace exrprofile
\ No newline at end of file
+} // end of namespace exrprofile
@@ -0,0 +1,240 @@
+//
+// Created by symek on 4/19/25.
+//
+#include "tiledread.h"
+#include "framebuffer.h"
+#include "perfcount.h"
+#include <OpenEXR/ImfTestFile.h>
+#include <OpenEXR/ImfPartType.h>
+#include <OpenEXR/ImfInputPart.h>
+#include <OpenEXR/ImfTiledInputPart.h>
+#include <map>
+#include <mutex>
+#include <random>
+
+namespace exrprofile {
+
+    namespace {
+
+        // (lx, ly) pairs of a tiled part, optionally just one level
+        std::vector<std::pair<int, int>> levels_of(const Imf::TiledInputPart &part, const int only) {
+            std::vector<std::pair<int, int>> levels;
+            switch (part.levelMode()) {
+                case Imf::MIPMAP_LEVELS:
+                    for (int l = 0; l < part.numLevels(); ++l)
+                        levels.emplace_back(l, l);
+                    break;
+                case Imf::RIPMAP_LEVELS:
+                    for (int ly = 0; ly < part.numYLevels(); ++ly)
+                        for (int lx = 0; lx < part.numXLevels(); ++lx)
+                            levels.emplace_back(lx, ly);
+                    break;
+                default:
+                    levels.emplace_back(0, 0);
+            }
+            if (only >= 0)
+                std::erase_if(levels, [only](const auto &level) { return level.first != only || level.second != only; });
+            return levels;
+        }
+
+        // The parts one reader has open on a file. Part objects are cheap views, the decoding state
+        // (frame buffer, line/tile buffers) lives in the file, hence the per part locks in shared mode.
+        class PartReader {
+        public:
+            PartReader(Imf::MultiPartInputFile &file, const std::vector<PixelLayout> &layouts)
+                    : file(file), layouts(layouts) {}
+
+            size_t read(const PartJob &job) {
+                PerfScope counters("region-caller");
+                const PixelLayout &layout = layouts[job.part];
+                if (job.tiled) {
+                    auto &part = tiled[job.part];
+                    if (!part) part = std::make_unique<Imf::TiledInputPart>(file, job.part);
+                    const Imath::Box2i window = part->dataWindowForTile(job.dx, job.dy, job.lx, job.ly);
+                    const size_t bytes = prepare(layout, window);
+                    part->setFrameBuffer(frame_buffer_for(layout, window, buffer.data()));
+                    part->readTile(job.dx, job.dy, job.lx, job.ly);
+                    return bytes;
+                }
+
+                auto &part = scanline[job.part];
+                if (!part) part = std::make_unique<Imf::InputPart>(file, job.part);
+                const Imath::Box2i &dw = part->header().dataWindow();
+                const Imath::Box2i window(Imath::V2i(dw.min.x, job.rows.first), Imath::V2i(dw.max.x, job.rows.second));
+                const size_t bytes = prepare(layout, window);
+                part->setFrameBuffer(frame_buffer_for(layout, window, buffer.data()));
+                part->readPixels(job.rows.first, job.rows.second);
+                return bytes;
+            }
+
+            long alloc_ns = 0;   // spent on new pixel buffers
+
+        private:
+            size_t prepare(const PixelLayout &layout, const Imath::Box2i &window) {
+                const size_t bytes = static_cast<size_t>(window.max.x - window.min.x + 1)
+                                     * (window.max.y - window.min.y + 1) * layout.pixel_size;
+                if (buffer.size() < bytes) {
+                    buffer = buffer_pool().acquire(bytes);
+                    alloc_ns += buffer.cost_ns();
+                }
+                return bytes;
+            }
+
+            Imf::MultiPartInputFile &file;
+            const std::vector<PixelLayout> &layouts;
+            std::map<int, std::unique_ptr<Imf::TiledInputPart>> tiled;
+            std::map<int, std::unique_ptr<Imf::InputPart>> scanline;
+            BufferPool::Buffer buffer;
+        };
+    }
+
+    bool needs_part_reader(const std::string &filename, const StagedFile *staged) {
+        bool tiled = false, deep = false, multipart = false;
+        if (staged) {
+            MemoryIStream stream(filename, staged->bytes.get(), staged->size);
+            if (!Imf::isOpenExrFile(stream, tiled, deep, multipart))
+                return false;
+        } else if (!Imf::isOpenExrFile(filename.c_str(), tiled, deep, multipart)) {
+            return false;
+        }
+        return tiled || multipart;
+    }
+
+    Stats multipart_read(const std::string &filename, const int num_threads, ThreadPool &pool,
+                         const ReadOptions &options) {
+
+        if (options.file_threads <= 0)
+            Imf::setGlobalThreadCount(num_threads);
+        if (!options.quiet)
+            std::cout << "Using " << num_threads << " OpenEXR threads (part reader, " << backend_name(options.io)
+                      << " I/O, " << cache_mode_name(options.cache) << " cache)." << std::endl;
+
+        Stats result{};
+
+        try {
+            StagedFile staged;
+            const long fetch_ns = fetch_frame(filename, options, staged);
+            const StagedFile *source = options.prefetched ? options.prefetched
+                                                          : options.cache != CacheMode::none ? &staged : nullptr;
+
+            const auto start_open = Clock::now();
+            const auto stream = open_frame(filename, options, source);
+            Imf::MultiPartInputFile file(*stream, file_thread_count(options));
+            const auto open_time = elapsed_ns(start_open);
+
+            // One job list for the whole file: tiles of all parts and levels, scanline parts in regions.
+            std::vector<PixelLayout> layouts;
+            std::vector<PartJob> jobs;
+            std::mt19937 random(static_cast<unsigned>(std::hash<std::string>{}(filename)));
+            long redundant_chunks = 0;
+            for (int p = 0; p < file.parts(); ++p) {
+                const Imf::Header &header = file.header(p);
+                std::vector<std::string> missing;
+                layouts.push_back(layout_for(header.channels(), options.channels, options.pixel_type, &missing));
+                warn_missing_channels(missing);
+                if (header.hasType() && Imf::isDeepData(header.type())) {
+                    if (!options.quiet)
+                        fmt::print("{:>15}: part {} is deep, skipped\n", "part", p);
+                    continue;
+                }
+                const bool tiled = header.hasType() ? Imf::isTiled(header.type()) : header.hasTileDescription();
+                if (!tiled) {
+                    const auto plan = plan_regions(header.dataWindow(), num_threads,
+                                                   scanlines_per_chunk(header.compression()), options.partition);
+                    redundant_chunks += plan.redundant_chunks;
+                    for (const auto &rows: plan.regions)
+                        jobs.push_back(PartJob{.part = p, .tiled = false, .rows = rows});
+                    continue;
+                }
+
+                Imf::TiledInputPart part(file, p);
+                for (const auto &[lx, ly]: levels_of(part, options.level)) {
+                    const int nx = part.numXTiles(lx);
+                    const int ny = part.numYTiles(ly);
+                    // A texture cache rarely wants a whole level, rather a handful of neighbouring tiles.
+                    const int wx = options.window > 0 ? std::min(options.window, nx) : nx;
+                    const int wy = options.window > 0 ? std::min(options.window, ny) : ny;
+                    const int x0 = wx < nx ? static_cast<int>(random() % (nx - wx + 1)) : 0;
+                    const int y0 = wy < ny ? static_cast<int>(random() % (ny - wy + 1)) : 0;
+                    for (int dy = y0; dy < y0 + wy; ++dy)
+                        for (int dx = x0; dx < x0 + wx; ++dx)
+                            jobs.push_back(PartJob{.part = p, .tiled = true, .lx = lx, .ly = ly, .dx = dx, .dy = dy});
+                }
+            }
+
+            WorkCursor<PartJob> cursor(jobs);
+            TaskGroup readers;
+            std::vector<std::mutex> part_locks(file.parts());
+            std::atomic<long> setup_ns(0);
+            std::atomic<long> alloc_ns(0);
+            std::atomic<long> decoded_bytes(0);
+            std::atomic<int> completed(0);
+
+            const auto start_decompress = Clock::now();
+            const size_t reader_count = std::min<size_t>(std::max(num_threads, 1), jobs.size());
+            for (size_t i = 0; i < reader_count; ++i) {
+                pool.enqueue(readers, [&]() {
+                    try {
+                        PartJob job;
+                        if (!cursor.take(job))
+                            return;
+                        if (options.shared_file) {
+                            PartReader reader(file, layouts);
+                            do {
+                                std::scoped_lock lock(part_locks[job.part]);
+                                decoded_bytes += (long) reader.read(job);
+                                completed.fetch_add(1, std::memory_order_relaxed);
+                            } while (cursor.take(job));
+                            alloc_ns.fetch_add(reader.alloc_ns, std::memory_order_relaxed);
+                            return;
+                        }
+                        // Own file per reader, opened once and kept for every job it takes.
+                        const auto start_reader = Clock::now();
+                        const auto reader_stream = open_frame(filename, options, source);
+                        Imf::MultiPartInputFile reader_file(*reader_stream, file_thread_count(options));
+                        setup_ns.fetch_add(elapsed_ns(start_reader),
+                                           std::memory_order_relaxed);
+                        PartReader reader(reader_file, layouts);
+                        do {
+                            decoded_bytes += (long) reader.read(job);
+                            completed.fetch_add(1, std::memory_order_relaxed);
+                        } while (cursor.take(job));
+                        alloc_ns.fetch_add(reader.alloc_ns, std::memory_order_relaxed);
+                    } catch (const std::exception &e) {
+                        std::cerr << "Error reading EXR file part: " << e.what() << std::endl;
+                    }
+                });
+            }
+            pool.wait(readers);
+            const auto end_decompress = Clock::now();
+
+            auto decompression_ns = elapsed_ns(start_decompress, end_decompress) + open_time;
+            setup_ns += open_time;
+
+            if (source) {
+                result[Records::fetch] = fetch_ns;
+                result[Records::decode] = decompression_ns;
+                decompression_ns += fetch_ns;
+            }
+            if (!options.quiet) {
+                if (source) {
+                    fmt::print("{:>15}: {:.6f} seconds\n", "fetch", ns_to_seconds(fetch_ns));
+                    fmt::print("{:>15}: {:.6f} seconds\n", "decode", ns_to_seconds(result[Records::decode]));
+                }
+                fmt::print("{:>15}: {:.6f} seconds\n", "decompression", ns_to_seconds(decompression_ns));
+                fmt::print("{:>15}: {:.3f} ms\n", "setup", ns_to_ms(setup_ns.load()));
+                fmt::print("{:>15}: {} of {} jobs in {} parts, {:.2f}MB decoded\n", "parts", completed.load(),
+                           jobs.size(), file.parts(), (double) decoded_bytes.load() / (1024 * 1024));
+            }
+            result[Records::decompression] = decompression_ns;
+            result[Records::setup] = setup_ns.load();
+            result[Records::redundant] = redundant_chunks;
+            result[Records::alloc] = alloc_ns.load();
+
+        } catch (const std::exception &e) {
+            std::cerr << "Error reading EXR file: " << e.what() << std::endl;
+        }
+        return result;
+    }
+
+} // end of namespace exrprofile
@@ -0,0 +1,30 @@
+//
+// Created by symek on 4/19/25.
+//
+#pragma once
+#include <OpenEXR/ImfMultiPartInputFile.h>
+#include <string>
+#include "mtread.h"
+
+namespace exrprofile {
+
+    // One unit of work of the part reader: a single tile of one level, or a run of scanlines.
+    struct PartJob {
+        int part = 0;
+        bool tiled = false;
+        int lx = 0, ly = 0, dx = 0, dy = 0;   // tiled parts
+        Rows rows{0, -1};                     // scanline parts
+    };
+
+    // Cheap magic/version check, true for files RgbaInputFile can't profile properly.
+    // Looks at the staged bytes instead of the file when there are some.
+    bool needs_part_reader(const std::string &filename, const StagedFile *staged = nullptr);
+
+    // Reads every part of a (multipart, tiled, mip/rip-mapped) file with the pool. Tiles of all parts
+    // and levels go into one job list, scanline parts are cut like multithreaded_read does.
+    // options.level and options.window narrow tiled parts down to a single level and/or a
+    // random window of tiles, which is what a texture cache does.
+    Stats multipart_read(const std::string &filename, int num_threads, ThreadPool &pool,
+                         const ReadOptions &options = {});
+
+} // end of namespace exrprofile
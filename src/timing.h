@@ -0,0 +1,42 @@
+//
+// Created by symek on 4/26/25.
+//
+#pragma once
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+namespace exrprofile {
+
+    // All timings are steady_clock nanoseconds, converted for printing only.
+    using Clock = std::chrono::steady_clock;
+
+    inline long elapsed_ns(const Clock::time_point &start, const Clock::time_point &end = Clock::now()) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    }
+
+    constexpr double ns_to_ms(const double ns) { return ns / 1e6; }
+    constexpr double ns_to_seconds(const double ns) { return ns / 1e9; }
+
+    // How often a measured step is run: warmup runs are thrown away, every repetition is kept.
+    struct Harness {
+        int warmup = 0;
+        int repetitions = 1;
+    };
+
+    // Runs `step` warmup + repetitions times, returns one sample (ns) per repetition.
+    template<typename Func>
+    std::vector<long> measure(const Harness &harness, Func &&step) {
+        for (int i = 0; i < harness.warmup; ++i)
+            step();
+        std::vector<long> samples;
+        samples.reserve(std::max(harness.repetitions, 1));
+        for (int i = 0; i < std::max(harness.repetitions, 1); ++i) {
+            const auto start = Clock::now();
+            step();
+            samples.push_back(elapsed_ns(start));
+        }
+        return samples;
+    }
+
+} // end of namespace exrprofile
@@ -0,0 +1,344 @@
+//
+// Created by symek on 6/21/25.
+//
+#include "uring.h"
+#include <algorithm>
+#include <stdexcept>
+#ifdef EXRPROFILE_HAVE_LIBURING
+#include <liburing.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#endif
+
+namespace exrprofile {
+
+    double UringStats::overlap_efficiency() const {
+        const long shorter = std::min(io_ns, decode_ns);
+        return shorter > 0 ? (double) overlap_ns / (double) shorter : 0.0;
+    }
+
+    void UringStats::merge(const UringStats &other) {
+        wall_ns += other.wall_ns;
+        io_ns += other.io_ns;
+        decode_ns += other.decode_ns;
+        overlap_ns += other.overlap_ns;
+        depth_ns += other.depth_ns;
+        max_depth = std::max(max_depth, other.max_depth);
+        bytes += other.bytes;
+    }
+
+    void print_uring_stats(const UringStats &stats, const UringOptions &options) {
+        fmt::print("io_uring: {:.1f} of {} reads in flight on average (max {}), {:.1f} MB/s\n", stats.mean_depth(),
+                   options.queue_depth, stats.max_depth,
+                   (double) stats.bytes / (1024 * 1024) / std::max(ns_to_seconds(stats.wall_ns), 1e-9));
+        fmt::print("{:>15}: {:.3f} s busy\n", "I/O", ns_to_seconds(stats.io_ns));
+        fmt::print("{:>15}: {:.3f} s busy\n", "decode", ns_to_seconds(stats.decode_ns));
+        fmt::print("{:>15}: {:.3f} s, {:.1f}% of the shorter one hidden, wall {:.3f} s\n", "overlap",
+                   ns_to_seconds(stats.overlap_ns), 100.0 * stats.overlap_efficiency(), ns_to_seconds(stats.wall_ns));
+    }
+
+#ifdef EXRPROFILE_HAVE_LIBURING
+
+    namespace {
+
+        constexpr uint64_t alignment = 4096;
+
+        struct Frame;
+
+        struct Block {
+            Frame *frame = nullptr;
+            uint64_t offset = 0;
+            uint32_t length = 0;
+        };
+
+        struct Frame {
+            size_t index = 0;
+            int fd = -1;
+            StagedFile staged;
+            std::vector<Block> blocks;
+            size_t pending = 0;         // blocks not completed yet
+            bool failed = false;
+            Clock::time_point first_submit{};
+            long fetch_ns = 0;
+        };
+
+        // Busy time bookkeeping of the I/O thread and the decoders, both report under one mutex.
+        class Activity {
+        public:
+            explicit Activity(const Clock::time_point start) : last(start) {}
+
+            void reads(const int in_flight) {
+                std::scoped_lock lock(mutex);
+                advance();
+                reading = in_flight;
+                stats.max_depth = std::max(stats.max_depth, in_flight);
+            }
+            void decoding(const int change) {
+                std::scoped_lock lock(mutex);
+                advance();
+                decoders += change;
+            }
+            UringStats finish() {
+                std::scoped_lock lock(mutex);
+                advance();
+                return stats;
+            }
+
+        private:
+            void advance() {
+                const auto now = Clock::now();
+                const long span = elapsed_ns(last, now);
+                last = now;
+                if (reading > 0) {
+                    stats.io_ns += span;
+                    stats.depth_ns += (double) reading * (double) span;
+                }
+                if (decoders > 0)
+                    stats.decode_ns += span;
+                if (reading > 0 && decoders > 0)
+                    stats.overlap_ns += span;
+            }
+
+            std::mutex mutex;
+            Clock::time_point last;
+            int reading = 0;
+            int decoders = 0;
+            UringStats stats;
+        };
+
+        void open_frame_for_ring(Frame &frame, const std::string &filename, const ReadOptions &read_options,
+                                 const uint64_t block) {
+            if (read_options.cache == CacheMode::cold && !evict_file(filename))
+                std::cerr << "Could not evict " << filename << " from page cache, reading it warm." << std::endl;
+            const bool direct = read_options.cache == CacheMode::direct;
+            frame.fd = ::open(filename.c_str(), O_RDONLY | (direct ? O_DIRECT : 0));
+            struct stat st{};
+            if (frame.fd < 0 || ::fstat(frame.fd, &st) != 0)
+                throw std::runtime_error("Cannot open " + filename + ": " + std::strerror(errno));
+            frame.staged.size = static_cast<uint64_t>(st.st_size);
+
+            // O_DIRECT wants aligned offsets, lengths and buffer, so the last read goes up to a whole block.
+            const uint64_t capacity = std::max<uint64_t>((frame.staged.size + alignment - 1) / alignment * alignment,
+                                                         alignment);
+            frame.staged.bytes.reset(static_cast<char *>(std::aligned_alloc(alignment, capacity)));
+            if (!frame.staged.bytes)
+                throw std::bad_alloc();
+            const uint64_t end = direct ? capacity : frame.staged.size;
+            for (uint64_t offset = 0; offset < end; offset += block)
+                frame.blocks.push_back(Block{&frame, offset, static_cast<uint32_t>(std::min(block, end - offset))});
+            frame.pending = frame.blocks.size();
+        }
+
+        void close_frame(Frame &frame) {
+            if (frame.fd >= 0)
+                ::close(frame.fd);
+            frame.fd = -1;
+        }
+    }
+
+    bool uring_available() {
+        io_uring ring{};
+        if (io_uring_queue_init(1, &ring, 0) < 0)
+            return false;
+        io_uring_queue_exit(&ring);
+        return true;
+    }
+
+    UringPass uring_pass(const std::vector<std::string> &files, const int workers, const ReadOptions &read_options,
+                         const UringOptions &options, const StagedReader &reader) {
+        const int queue_depth = std::max(options.queue_depth, 1);
+        const uint64_t block = std::max<uint64_t>(static_cast<uint64_t>(options.block_kb) * 1024 / alignment,
+                                                  1) * alignment;
+        const size_t ahead = options.frames_ahead > 0 ? options.frames_ahead : 2 * std::max(workers, 1);
+
+        io_uring ring{};
+        const int error = io_uring_queue_init(queue_depth, &ring, 0);
+        if (error < 0)
+            throw std::runtime_error(std::string("Cannot set up io_uring: ") + std::strerror(-error));
+
+        UringPass result;
+        PassCollector collector(std::max(workers, 1), files.size());
+        std::vector<Frame> frames(files.size());
+
+        // Handed over to decoders, guarded by the mutex
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<Frame *> fetched;
+        size_t decoded = 0;
+        bool fetching = true;
+
+        const auto start = Clock::now();
+        Activity activity(start);
+        ProgressPrinter printer(collector, read_options.progress);
+
+        std::vector<std::thread> decoders;
+        for (int i = 0; i < std::max(workers, 1); ++i) {
+            decoders.emplace_back([&, i]() {
+                while (true) {
+                    Frame *frame;
+                    {
+                        std::unique_lock lock(mutex);
+                        changed.wait(lock, [&]() { return !fetched.empty() || !fetching; });
+                        if (fetched.empty())
+                            return;
+                        frame = fetched.front();
+                        fetched.pop_front();
+                    }
+                    Stats stats{};
+                    if (!frame->failed) {
+                        activity.decoding(+1);
+                        try {
+                            stats = reader(files[frame->index], frame->staged);
+                        } catch (const std::exception &e) {
+                            std::cerr << "Error decoding " << files[frame->index] << ": " << e.what() << std::endl;
+                        }
+                        activity.decoding(-1);
+                    }
+                    stats[Records::fetch] = frame->fetch_ns;
+                    collector.record(i, frame->index, stats);
+                    frame->staged = StagedFile{};
+                    {
+                        std::scoped_lock lock(mutex);
+                        ++decoded;
+                    }
+                    changed.notify_all();
+                }
+            });
+        }
+
+        auto hand_over = [&](Frame &frame) {
+            close_frame(frame);
+            frame.fetch_ns = elapsed_ns(frame.first_submit);
+            {
+                std::scoped_lock lock(mutex);
+                fetched.push_back(&frame);
+            }
+            changed.notify_all();
+        };
+
+        // The I/O side: this thread opens frames up to `ahead` in front of the decoders and keeps the ring full.
+        std::deque<Block *> queued;
+        size_t opened = 0, done = 0;
+        int in_flight = 0;
+        while (done < files.size()) {
+            {
+                std::unique_lock lock(mutex);
+                // Nothing to read and too far ahead of the decoders: wait for them to catch up.
+                if (queued.empty() && in_flight == 0 && opened < files.size())
+                    changed.wait(lock, [&]() { return opened - decoded < ahead; });
+                while (opened < files.size() && opened - decoded < ahead) {
+                    Frame &frame = frames[opened];
+                    frame.index = opened++;
+                    frame.first_submit = Clock::now();
+                    lock.unlock();
+                    try {
+                        open_frame_for_ring(frame, files[frame.index], read_options, block);
+                    } catch (const std::exception &e) {
+                        std::cerr << "Error fetching " << files[frame.index] << ": " << e.what() << std::endl;
+                        frame.failed = true;
+                        frame.pending = 0;
+                    }
+                    for (auto &frame_block: frame.blocks)
+                        queued.push_back(&frame_block);
+                    if (frame.pending == 0) {
+                        hand_over(frame);
+                        ++done;
+                    }
+                    lock.lock();
+                }
+            }
+
+            int submitted = 0;
+            while (in_flight < queue_depth && !queued.empty()) {
+                io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+                if (!sqe)
+                    break;
+                Block *request = queued.front();
+                queued.pop_front();
+                io_uring_prep_read(sqe, request->frame->fd, request->frame->staged.bytes.get() + request->offset,
+                                   request->length, request->offset);
+                io_uring_sqe_set_data(sqe, request);
+                ++in_flight;
+                ++submitted;
+            }
+            if (submitted > 0) {
+                io_uring_submit(&ring);
+                activity.reads(in_flight);
+            }
+            if (in_flight == 0)
+                continue;
+
+            io_uring_cqe *cqe = nullptr;
+            if (io_uring_wait_cqe(&ring, &cqe) < 0)
+                continue;
+            do {
+                auto *request = static_cast<Block *>(io_uring_cqe_get_data(cqe));
+                const int res = cqe->res;
+                io_uring_cqe_seen(&ring, cqe);
+                --in_flight;
+                Frame &frame = *request->frame;
+
+                if (res == -EAGAIN || res == -EINTR) {
+                    queued.push_front(request);
+                    continue;
+                }
+                if (res > 0) {
+                    result.stats.bytes += res;
+                    if (static_cast<uint32_t>(res) < request->length && request->offset + res < frame.staged.size) {
+                        // Short read, the rest goes back in front
+                        request->offset += res;
+                        request->length -= res;
+                        queued.push_front(request);
+                        continue;
+                    }
+                } else if (res < 0 || request->offset < frame.staged.size) {
+                    std::cerr << "Error reading " << files[frame.index] << ": "
+                              << (res < 0 ? std::strerror(-res) : "unexpected end of file") << std::endl;
+                    frame.failed = true;
+                }
+                if (--frame.pending == 0) {
+                    hand_over(frame);
+                    ++done;
+                }
+            } while (io_uring_peek_cqe(&ring, &cqe) == 0);
+            activity.reads(in_flight);
+        }
+        io_uring_queue_exit(&ring);
+
+        {
+            std::scoped_lock lock(mutex);
+            fetching = false;
+        }
+        changed.notify_all();
+        for (auto &decoder: decoders)
+            decoder.join();
+
+        const uint64_t bytes = result.stats.bytes;
+        result.stats = activity.finish();
+        result.stats.bytes = bytes;
+        result.stats.wall_ns = elapsed_ns(start);
+        result.pass.wall_ns = result.stats.wall_ns;
+        result.pass.frames = collector.merge();
+        return result;
+    }
+
+#else
+
+    bool uring_available() { return false; }
+
+    UringPass uring_pass(const std::vector<std::string> &, int, const ReadOptions &, const UringOptions &,
+                         const StagedReader &) {
+        throw std::runtime_error("exrprofile was built without liburing");
+    }
+
+#endif
+
+} // end of namespace exrprofile
@@ -0,0 +1,55 @@
+//
+// Created by symek on 6/21/25.
+//
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+#include "mtread.h"
+
+namespace exrprofile {
+
+    struct UringOptions {
+        int queue_depth = 32;       // reads in flight on the ring
+        int block_kb = 1024;        // size of one read
+        int frames_ahead = 0;       // frames fetched but not decoded yet, 0: two per worker
+    };
+
+    // Decodes a frame from bytes the ring has fetched.
+    using StagedReader = std::function<Stats(const std::string &, const StagedFile &)>;
+
+    // Where the time of a pass went. I/O is busy while any read is in flight, decode while any
+    // worker decodes, and overlap is the time both were.
+    struct UringStats {
+        long wall_ns = 0;
+        long io_ns = 0;
+        long decode_ns = 0;
+        long overlap_ns = 0;
+        double depth_ns = 0.0;      // reads in flight integrated over time
+        int max_depth = 0;
+        uint64_t bytes = 0;
+
+        double mean_depth() const { return io_ns > 0 ? depth_ns / (double) io_ns : 0.0; }
+        // Share of the shorter of I/O and decode hidden behind the other, 1.0 is a perfect pipeline.
+        double overlap_efficiency() const;
+        void merge(const UringStats &other);
+    };
+
+    struct UringPass {
+        PassResult pass;
+        UringStats stats;
+    };
+
+    // False when built without liburing or when the kernel refuses to set up a ring.
+    bool uring_available();
+
+    // Reads every file of the list, in order, in block sized reads on one io_uring shared by all frames,
+    // at most options.queue_depth in flight. Frames whose blocks are all in go to `workers` decode
+    // threads, so fetching the next frames overlaps decoding the current ones. The cache mode of
+    // read_options is honoured (cold evicts first, direct reads with O_DIRECT). fetch of a frame is
+    // its first submit to its last completion.
+    UringPass uring_pass(const std::vector<std::string> &files, int workers, const ReadOptions &read_options,
+                         const UringOptions &options, const StagedReader &reader);
+    void print_uring_stats(const UringStats &stats, const UringOptions &options);
+
+} // end of namespace exrprofile
@@ -0,0 +1,288 @@
+//
+// Created by symek on 7/12/25.
+//
+#include "verify.h"
+#include "timing.h"
+#include <OpenEXR/ImfInputFile.h>
+#include <Imath/half.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <fmt/core.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace exrprofile {
+
+    namespace {
+
+        constexpr int band_rows = 16;
+
+        struct Accumulator {
+            double sum_sq = 0.0;
+            double max_abs = 0.0;
+            double peak = 0.0;
+            uint64_t nonfinite = 0;
+
+            void add(const Accumulator &other) {
+                sum_sq += other.sum_sq;
+                max_abs = std::max(max_abs, other.max_abs);
+                peak = std::max(peak, other.peak);
+                nonfinite += other.nonfinite;
+            }
+        };
+
+        void half_to_float(const uint16_t *in, float *out, const size_t count) {
+            size_t i = 0;
+#ifdef __F16C__
+            for (; i < count / 8 * 8; i += 8) {
+                const __m128i halves = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+                _mm256_storeu_ps(out + i, _mm256_cvtph_ps(halves));
+            }
+#endif
+            for (; i < count; ++i) {
+                Imath::half value;
+                value.setBits(in[i]);
+                out[i] = value;
+            }
+        }
+
+        // A row of interleaved samples as floats: float rows as they are, half rows converted in one
+        // go, mixed rows sample by sample.
+        const float *row_as_floats(const char *row, const PixelLayout &layout, const size_t width, float *scratch) {
+            const auto &channels = layout.channels;
+            const size_t count = width * channels.size();
+            auto all = [&](const Imf::PixelType type) {
+                return std::all_of(channels.begin(), channels.end(), [&](const auto &c) { return c.second == type; });
+            };
+            if (all(Imf::FLOAT))
+                return reinterpret_cast<const float *>(row);
+            if (all(Imf::HALF)) {
+                half_to_float(reinterpret_cast<const uint16_t *>(row), scratch, count);
+                return scratch;
+            }
+            for (size_t x = 0, i = 0; x < width; ++x) {
+                for (const auto &[name, type]: channels) {
+                    if (type == Imf::HALF) {
+                        uint16_t bits;
+                        std::memcpy(&bits, row, sizeof(bits));
+                        Imath::half value;
+                        value.setBits(bits);
+                        scratch[i++] = value;
+                    } else if (type == Imf::FLOAT) {
+                        std::memcpy(&scratch[i++], row, sizeof(float));
+                    } else {
+                        uint32_t value;
+                        std::memcpy(&value, row, sizeof(value));
+                        scratch[i++] = static_cast<float>(value);
+                    }
+                    row += pixel_type_size(type);
+                }
+            }
+            return scratch;
+        }
+
+        void accumulate_sample(const float source, const float decoded, Accumulator &acc) {
+            if (!std::isfinite(source) || !std::isfinite(decoded)) {
+                acc.nonfinite += !(source == decoded);
+                return;
+            }
+            const double diff = std::fabs((double) decoded - (double) source);
+            acc.sum_sq += diff * diff;
+            acc.max_abs = std::max(acc.max_abs, diff);
+            acc.peak = std::max(acc.peak, (double) std::fabs(source));
+        }
+
+        // Errors of `count` interleaved samples (a whole row, starting with channel 0) into `acc`, one per channel.
+        void accumulate_row(const float *source, const float *decoded, const size_t count, const size_t channels,
+                            Accumulator *acc) {
+            size_t i = 0;
+#ifdef __AVX2__
+            // Sample i is channel i % channels. A block of lcm(8, channels) samples spans whole pixels,
+            // so lane j of the k-th vector of a block always holds channel (8k + j) % channels.
+            constexpr size_t max_vectors = 8;
+            const size_t vectors = channels / std::gcd(channels, size_t{8});
+            if (vectors <= max_vectors) {
+                const size_t block = vectors * 8;
+                const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+                const __m256 infinity = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+                __m256 sum[max_vectors], top[max_vectors], peak[max_vectors];
+                for (size_t k = 0; k < vectors; ++k)
+                    sum[k] = top[k] = peak[k] = _mm256_setzero_ps();
+
+                for (; i + block <= count; i += block) {
+                    for (size_t k = 0; k < vectors; ++k) {
+                        const __m256 s = _mm256_loadu_ps(source + i + 8 * k);
+                        const __m256 d = _mm256_loadu_ps(decoded + i + 8 * k);
+                        const __m256 abs_s = _mm256_and_ps(s, abs_mask);
+                        // false for inf and NaN on either side
+                        const __m256 finite = _mm256_and_ps(_mm256_cmp_ps(abs_s, infinity, _CMP_LT_OQ),
+                                                            _mm256_cmp_ps(_mm256_and_ps(d, abs_mask), infinity,
+                                                                          _CMP_LT_OQ));
+                        const __m256 diff = _mm256_and_ps(_mm256_and_ps(_mm256_sub_ps(d, s), abs_mask), finite);
+                        sum[k] = _mm256_add_ps(sum[k], _mm256_mul_ps(diff, diff));
+                        top[k] = _mm256_max_ps(top[k], diff);
+                        peak[k] = _mm256_max_ps(peak[k], _mm256_and_ps(abs_s, finite));
+
+                        int mismatched = _mm256_movemask_ps(_mm256_andnot_ps(finite, _mm256_cmp_ps(s, d, _CMP_NEQ_UQ)));
+                        for (; mismatched; mismatched &= mismatched - 1)
+                            ++acc[(8 * k + __builtin_ctz(mismatched)) % channels].nonfinite;
+                    }
+                }
+
+                alignas(32) float lanes[3][8];
+                for (size_t k = 0; k < vectors; ++k) {
+                    _mm256_store_ps(lanes[0], sum[k]);
+                    _mm256_store_ps(lanes[1], top[k]);
+                    _mm256_store_ps(lanes[2], peak[k]);
+                    for (size_t j = 0; j < 8; ++j) {
+                        Accumulator &channel = acc[(8 * k + j) % channels];
+                        channel.sum_sq += lanes[0][j];
+                        channel.max_abs = std::max(channel.max_abs, (double) lanes[1][j]);
+                        channel.peak = std::max(channel.peak, (double) lanes[2][j]);
+                    }
+                }
+            }
+#endif
+            for (; i < count; ++i)
+                accumulate_sample(source[i], decoded[i], acc[i % channels]);
+        }
+    }
+
+    double ChannelError::psnr() const {
+        if (rmse == 0.0)
+            return std::numeric_limits<double>::infinity();
+        return 20.0 * std::log10((peak > 0.0 ? peak : 1.0) / rmse);
+    }
+
+    BufferPool::Buffer decode_pixels(Imf::IStream &stream, const SourceImage &like, const int threads) {
+        Imf::InputFile file(stream, threads);
+        const Imath::Box2i &dw = like.header.dataWindow();
+        if (file.header().dataWindow() != dw)
+            throw std::runtime_error("Decoded data window differs from the source");
+        auto pixels = buffer_pool().acquire(like.raw_bytes());
+        file.setFrameBuffer(frame_buffer_for(like.layout, dw, pixels.data()));
+        file.readPixels(dw.min.y, dw.max.y);
+        return pixels;
+    }
+
+    ImageError compare_pixels(const SourceImage &source, const char *decoded, ThreadPool &pool) {
+        const Imath::Box2i &dw = source.header.dataWindow();
+        const size_t width = dw.max.x - dw.min.x + 1;
+        const int height = dw.max.y - dw.min.y + 1;
+        const size_t channels = source.layout.channels.size();
+        const size_t row_bytes = width * source.layout.pixel_size;
+
+        std::mutex mutex;
+        std::vector<Accumulator> totals(channels);
+        TaskGroup bands;
+        for (int y0 = 0; y0 < height && channels > 0; y0 += band_rows) {
+            pool.enqueue(bands, [&, y0]() {
+                std::vector<float> source_row(width * channels), decoded_row(width * channels);
+                std::vector<Accumulator> band(channels);
+                for (int y = y0; y < std::min(y0 + band_rows, height); ++y) {
+                    // float sums per row, doubles across rows
+                    std::vector<Accumulator> row(channels);
+                    const size_t offset = static_cast<size_t>(y) * row_bytes;
+                    accumulate_row(row_as_floats(source.pixels + offset, source.layout, width, source_row.data()),
+                                   row_as_floats(decoded + offset, source.layout, width, decoded_row.data()),
+                                   width * channels, channels, row.data());
+                    for (size_t c = 0; c < channels; ++c)
+                        band[c].add(row[c]);
+                }
+                std::scoped_lock lock(mutex);
+                for (size_t c = 0; c < channels; ++c)
+                    totals[c].add(band[c]);
+            });
+        }
+        pool.wait(bands);
+
+        ImageError error;
+        const uint64_t samples = static_cast<uint64_t>(width) * height;
+        for (size_t c = 0; c < channels; ++c) {
+            ChannelError channel;
+            channel.name = source.layout.channels[c].first;
+            channel.samples = samples;
+            channel.nonfinite = totals[c].nonfinite;
+            channel.max_abs = totals[c].max_abs;
+            channel.peak = totals[c].peak;
+            const uint64_t compared = samples - std::min(samples, channel.nonfinite);
+            channel.rmse = compared ? std::sqrt(totals[c].sum_sq / (double) compared) : 0.0;
+            error.push_back(channel);
+        }
+        return error;
+    }
+
+    double worst_psnr(const ImageError &error) {
+        double worst = std::numeric_limits<double>::infinity();
+        for (const auto &channel: error)
+            worst = std::min(worst, channel.psnr());
+        return worst;
+    }
+
+    double worst_max_abs(const ImageError &error) {
+        double worst = 0.0;
+        for (const auto &channel: error)
+            worst = std::max(worst, channel.max_abs);
+        return worst;
+    }
+
+    namespace {
+        std::string format_psnr(const double psnr) {
+            return std::isinf(psnr) ? std::string{"lossless"} : fmt::format("{:.2f} dB", psnr);
+        }
+    }
+
+    void print_image_error(const ImageError &error) {
+        if (std::all_of(error.begin(), error.end(), [](const auto &channel) { return channel.exact(); })) {
+            fmt::print("{:>15}: bit exact\n", "error");
+            return;
+        }
+        for (const auto &channel: error) {
+            fmt::print("{:>15}: max abs {:.6g} | RMSE {:.6g} | PSNR {}", channel.name, channel.max_abs, channel.rmse,
+                       format_psnr(channel.psnr()));
+            if (channel.nonfinite)
+                fmt::print(" | {} inf/NaN mismatched", channel.nonfinite);
+            fmt::print("\n");
+        }
+    }
+
+    std::vector<bool> pareto_frontier(const std::vector<RatePoint> &points) {
+        auto dominates = [](const RatePoint &a, const RatePoint &b) {
+            const bool no_worse = a.bytes <= b.bytes && a.decode_ns <= b.decode_ns && a.psnr >= b.psnr;
+            const bool better = a.bytes < b.bytes || a.decode_ns < b.decode_ns || a.psnr > b.psnr;
+            return no_worse && better;
+        };
+        std::vector<bool> frontier(points.size(), true);
+        for (size_t i = 0; i < points.size(); ++i)
+            for (size_t j = 0; j < points.size() && frontier[i]; ++j)
+                if (j != i && dominates(points[j], points[i]))
+                    frontier[i] = false;
+        return frontier;
+    }
+
+    void print_rate_distortion(const std::string &title, const std::vector<RatePoint> &points) {
+        if (points.empty())
+            return;
+        const auto frontier = pareto_frontier(points);
+        std::vector<size_t> order(points.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](const size_t a, const size_t b) {
+            return points[a].bytes < points[b].bytes;
+        });
+
+        fmt::print("\nSize, speed and error of {} (* best on size, decode time and PSNR together):\n", title);
+        for (const size_t i: order) {
+            const auto &point = points[i];
+            fmt::print("{} {:>23}: {:>9.2f}MB | encode {:>9.3f} ms | decode {:>9.3f} ms | PSNR {:>11} | max abs {:.4g}\n",
+                       frontier[i] ? '*' : ' ', point.name, (double) point.bytes / (1024 * 1024),
+                       ns_to_ms(point.encode_ns), ns_to_ms(point.decode_ns), format_psnr(point.psnr), point.max_abs);
+        }
+    }
+
+} // end of namespace exrprofile
@@ -0,0 +1,57 @@
+//
+// Created by symek on 7/12/25.
+//
+#pragma once
+#include <OpenEXR/ImfIO.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "bufferpool.h"
+#include "encode.h"
+#include "threadpool.h"
+
+namespace exrprofile {
+
+    // How far the decoded values of one channel are from the source. Samples where either side is
+    // inf or NaN are counted apart (NaN never matches) and left out of the errors.
+    struct ChannelError {
+        std::string name;
+        double max_abs = 0.0;
+        double rmse = 0.0;
+        double peak = 0.0;          // largest finite |source| value, the signal of the PSNR
+        uint64_t samples = 0;
+        uint64_t nonfinite = 0;
+
+        bool exact() const { return max_abs == 0.0 && nonfinite == 0; }
+        // dB against `peak` (1.0 for an all black channel), infinity when exact
+        double psnr() const;
+    };
+    using ImageError = std::vector<ChannelError>;
+
+    // Decodes an encoded frame into the layout and data window of `like`, for compare_pixels().
+    BufferPool::Buffer decode_pixels(Imf::IStream &stream, const SourceImage &like, int threads);
+
+    // Per channel errors of `decoded` (same layout as the source), in bands of rows on the pool.
+    // With AVX2 and F16C in the build, halfs are converted and compared eight at a time.
+    ImageError compare_pixels(const SourceImage &source, const char *decoded, ThreadPool &pool);
+
+    // Worst channel of an image
+    double worst_psnr(const ImageError &error);
+    double worst_max_abs(const ImageError &error);
+    void print_image_error(const ImageError &error);
+
+    // One codec setting on one source: what it costs and what it loses.
+    struct RatePoint {
+        std::string name;
+        uint64_t bytes = 0;
+        long encode_ns = 0;
+        long decode_ns = 0;
+        double psnr = 0.0;      // worst channel
+        double max_abs = 0.0;   // worst channel
+    };
+
+    // Points no other point beats on size, decode time and PSNR at once (ties are kept).
+    std::vector<bool> pareto_frontier(const std::vector<RatePoint> &points);
+    void print_rate_distortion(const std::string &title, const std::vector<RatePoint> &points);
+
+} // end of namespace exrprofile